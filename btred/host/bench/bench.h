@@ -0,0 +1,101 @@
+#pragma once
+
+// Shared helpers for the host micro-benchmarks.
+//
+// Per-call cost is counted in CPU cycles through perf_event_open where the
+// kernel allows it, falling back to nanoseconds otherwise. Each measurement
+// reports the median over many runs, which is robust against preemption.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <algorithm>
+#include <vector>
+#include "mock.h"
+
+class BenchCounter {
+public:
+    BenchCounter()
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        m_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+        if (m_fd >= 0)
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    ~BenchCounter()
+    {
+        if (m_fd >= 0)
+            close(m_fd);
+    }
+
+    const char* Unit() { return m_fd >= 0 ? "cycles" : "ns"; }
+
+    u64 Read()
+    {
+        if (m_fd >= 0) {
+            u64 v = 0;
+            if (read(m_fd, &v, sizeof(v)) == sizeof(v))
+                return v;
+        }
+
+        return mockNow();
+    }
+
+    // Median cost of one call of fn(), over `runs` calls.
+    template<typename F>
+    u64 Measure(F fn, size_t runs = 2000)
+    {
+        std::vector<u64> samples(runs);
+
+        // Warm caches and branch predictors first.
+        for (size_t i = 0; i < 16; i++)
+            fn();
+
+        for (size_t i = 0; i < runs; i++) {
+            u64 start = Read();
+            fn();
+            samples[i] = Read() - start;
+        }
+
+        std::sort(samples.begin(), samples.end());
+        return samples[runs / 2];
+    }
+
+private:
+    int m_fd;
+};
+
+inline void BenchHeader(const char* name, BenchCounter& counter)
+{
+    printf("%s: per-call cost in %s (median)\n", name, counter.Unit());
+#ifndef __aarch64__
+    printf("note: built with the scalar NEON shim, kernel timings are not representative\n");
+#endif
+}
+
+inline void BenchFillNoise(s16* pcm, size_t samples, u32 seed)
+{
+    for (size_t i = 0; i < samples; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        pcm[i] = (s16)(seed >> 16);
+    }
+}
+
+inline bool BenchCheck(const char* what, bool ok)
+{
+    printf("check %-48s %s\n", what, ok ? "ok" : "FAILED");
+    return ok;
+}
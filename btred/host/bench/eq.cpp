@@ -0,0 +1,213 @@
+#include <string.h>
+#include <math.h>
+#include <switch.h>
+#include <complex>
+#include "bt_dsp.h"
+#include "bench.h"
+
+// Parametric EQ, per 0x400 sample capture period, with 1, 4 and 8 bands.
+// The response is measured with sines through the very kernel the send
+// thread runs, and checked against the bands' exact response, evaluated in
+// double precision.
+
+#define RATE 48000
+#define SAMPLES 0x400
+#define TOLERANCE_DB 0.05
+
+static const DspEqBand g_curve[] = {
+    { DspEqType::HighPass,  20,    0,  0.707f },
+    { DspEqType::LowShelf,  105,   5,  0.707f },
+    { DspEqType::Peak,      250,  -2,  1.0f },
+    { DspEqType::Peak,      1200,  1.5f, 2.0f },
+    { DspEqType::Peak,      3200, -4,  3.0f },
+    { DspEqType::Peak,      6500,  3,  1.4f },
+    { DspEqType::HighShelf, 10000, -3, 0.707f },
+    { DspEqType::LowPass,   19000, 0,  0.707f },
+};
+
+// |H| of the first num_bands bands, at hz.
+static double ResponseDb(const DspEqBand* bands, size_t num_bands, double hz)
+{
+    std::complex<double> z = std::polar(1.0, -2 * M_PI * hz / RATE);
+    std::complex<double> h = 1.0;
+
+    for (size_t i = 0; i < num_bands; i++) {
+        double b[3];
+        double a[3];
+        DspEqDesign(&bands[i], RATE, b, a);
+        h *= (b[0] + b[1] * z + b[2] * z * z) / (a[0] + a[1] * z + a[2] * z * z);
+    }
+
+    return 20 * log10(std::abs(h));
+}
+
+static bool CheckExact()
+{
+    alignas(16) s16 src[SAMPLES];
+    alignas(16) s16 a[SAMPLES];
+    alignas(16) s16 b[SAMPLES];
+    bool ok = true;
+
+    for (size_t bands : { 1, 4, 8 }) {
+        DspEqState state_a;
+        DspEqState state_b;
+        bool ok_bands = true;
+
+        DspEqInit(&state_a, g_curve + 8 - bands, bands, RATE);
+        DspEqInit(&state_b, g_curve + 8 - bands, bands, RATE);
+
+        // Loud enough for the boosts to clip now and then.
+        for (u32 i = 0; i < 64; i++) {
+            BenchFillNoise(src, SAMPLES, i);
+            DspApplyEq(a, src, SAMPLES, &state_a);
+            DspApplyEqScalar(b, src, SAMPLES, &state_b);
+            ok_bands = ok_bands && memcmp(a, b, sizeof(a)) == 0 && memcmp(&state_a, &state_b, sizeof(state_a)) == 0;
+        }
+
+        char what[64];
+        snprintf(what, sizeof(what), "%zu band eq matches scalar reference", bands);
+        ok = BenchCheck(what, ok_bands) && ok;
+    }
+
+    return ok;
+}
+
+// The design itself: each band where it is pinned down.
+static bool CheckDesign()
+{
+    static const struct {
+        DspEqBand band;
+        double hz;
+        double db;
+    } points[] = {
+        { { DspEqType::Peak,      1000,  6,  1.0f },   1000,  6 },
+        { { DspEqType::Peak,      1000, -9,  4.0f },   1000, -9 },
+        { { DspEqType::LowShelf,  200,   6,  0.707f }, 200,   3 },
+        { { DspEqType::LowShelf,  200,   6,  0.707f }, 10,    6 },
+        { { DspEqType::HighShelf, 5000, -6,  0.707f }, 5000, -3 },
+        { { DspEqType::HighShelf, 5000, -6,  0.707f }, 23000, -6 },
+        { { DspEqType::LowPass,   8000,  0,  0.707f }, 8000,  20 * log10(0.707) },
+        { { DspEqType::HighPass,  80,    0,  0.707f }, 80,    20 * log10(0.707) },
+    };
+
+    double worst = 0;
+
+    for (auto& p : points) {
+        double err = fabs(ResponseDb(&p.band, 1, p.hz) - p.db);
+        worst = err > worst ? err : worst;
+    }
+
+    printf("design: worst error %.3f dB at the bands' anchor points\n", worst);
+    return BenchCheck("eq design hits its anchor points", worst < 0.05);
+}
+
+// Gain of the kernel at hz, from a sine on the left and its inverse on the
+// right, after the filters settled: the least-squares fit of a sine at hz.
+static bool MeasureDb(DspEqState* state, double hz, double* db)
+{
+    // In frames, whole periods.
+    const double amp = 4000;
+    const size_t settle = RATE / 4 / SAMPLES * SAMPLES;
+    const size_t measure = RATE / 2 / SAMPLES * SAMPLES;
+    alignas(16) s16 in[SAMPLES];
+    alignas(16) s16 out[SAMPLES];
+    double s[2] = { 0, 0 };
+    double c[2] = { 0, 0 };
+
+    for (size_t n = 0; n < settle + measure; n += SAMPLES / 2) {
+        for (size_t i = 0; i < SAMPLES / 2; i++) {
+            s16 v = (s16)lrint(amp * sin(2 * M_PI * hz * (n + i) / RATE));
+            in[2*i + 0] = v;
+            in[2*i + 1] = -v;
+        }
+
+        DspApplyEq(out, in, SAMPLES, state);
+
+        if (n < settle)
+            continue;
+
+        for (size_t i = 0; i < SAMPLES / 2; i++) {
+            double w = 2 * M_PI * hz * (n + i) / RATE;
+
+            for (size_t ch = 0; ch < 2; ch++) {
+                double y = ch == 0 ? out[2*i] : -out[2*i + 1];
+                s[ch] += y * sin(w);
+                c[ch] += y * cos(w);
+            }
+        }
+    }
+
+    double db_l = 20 * log10(2 * sqrt(s[0] * s[0] + c[0] * c[0]) / measure / amp);
+    double db_r = 20 * log10(2 * sqrt(s[1] * s[1] + c[1] * c[1]) / measure / amp);
+    *db = db_l;
+
+    // Both channels go through the same filter.
+    return fabs(db_l - db_r) < 0.01;
+}
+
+static bool CheckResponse()
+{
+    static const double freqs[] = {
+        50, 105, 180, 250, 400, 700, 1200, 2000, 3200, 4500, 6500, 8000, 10000, 12500, 15000, 17500,
+    };
+
+    DspEqState state;
+    double worst = 0;
+    bool ok_channels = true;
+
+    for (double hz : freqs) {
+        double db;
+
+        DspEqInit(&state, g_curve, 8, RATE);
+        ok_channels = MeasureDb(&state, hz, &db) && ok_channels;
+
+        double expected = ResponseDb(g_curve, 8, hz);
+        double err = fabs(db - expected);
+        worst = err > worst ? err : worst;
+        printf("  %6.0f Hz  %+6.2f dB  (exact %+6.2f)\n", hz, db, expected);
+    }
+
+    printf("response: worst error %.3f dB\n", worst);
+
+    bool ok = BenchCheck("8 band eq response, both channels alike", ok_channels);
+    char what[64];
+    snprintf(what, sizeof(what), "8 band eq response within %.2f dB", TOLERANCE_DB);
+    return BenchCheck(what, worst < TOLERANCE_DB) && ok;
+}
+
+int main()
+{
+    BenchCounter counter;
+    alignas(16) s16 pcm[SAMPLES];
+    alignas(16) s16 out[SAMPLES];
+
+    BenchHeader("eq", counter);
+
+    bool ok = CheckExact();
+    ok = CheckDesign() && ok;
+    ok = CheckResponse() && ok;
+
+    if (!ok)
+        return 1;
+
+    BenchFillNoise(pcm, SAMPLES, 5);
+
+    for (size_t bands : { 1, 4, 8 }) {
+        DspEqState state;
+        char label[64];
+
+        DspEqInit(&state, g_curve, bands, RATE);
+
+        snprintf(label, sizeof(label), "%zu band%s", bands, bands > 1 ? "s" : "");
+        printf("%-28s %8lu\n", label, (unsigned long)counter.Measure([&] {
+            DspApplyEq(out, pcm, SAMPLES, &state);
+        }));
+
+        snprintf(label, sizeof(label), "%zu band%s, scalar", bands, bands > 1 ? "s" : "");
+        printf("%-28s %8lu\n", label, (unsigned long)counter.Measure([&] {
+            DspApplyEqScalar(out, pcm, SAMPLES, &state);
+        }));
+    }
+
+    return 0;
+}
@@ -0,0 +1,213 @@
+#include <string.h>
+#include <switch.h>
+#include "bt_dsp.h"
+#include "bench.h"
+
+// Look-ahead limiter and safety mute, after the capture's volume: the NEON
+// pass against its scalar reference, the ceiling held on bursts well over
+// it, how fast sustained full scale or DC is muted and let go of again, with
+// and without limiting, and what the pass costs on a 0x400 sample buffer.
+// Also the peak the capture tells silence by.
+
+#define SAMPLES 0x400
+#define RATE 48000
+#define CEILING 0x7214      // -1 dB
+
+// Quiet noise, with loud bursts of a few frames every so often: the kind of
+// peak the look-ahead is for.
+static void FillBursts(s16* pcm, size_t samples, u32 seed)
+{
+    BenchFillNoise(pcm, samples, seed);
+
+    for (size_t i = 0; i < samples; i++) {
+        pcm[i] /= 8;
+
+        if (i % 0x180 < 12)
+            pcm[i] = (i & 1) ? -32768 : 32767;
+    }
+}
+
+// Without limiting, the ceiling is full scale.
+static DspLimiterState InitialState(bool is_limited)
+{
+    DspLimiterState state;
+    DspLimiterInit(&state, is_limited ? CEILING : DSP_Q15_ONE, RATE);
+    return state;
+}
+
+static bool CheckExact(bool is_limited)
+{
+    DspLimiterState state_a = InitialState(is_limited);
+    DspLimiterState state_b = InitialState(is_limited);
+    alignas(16) s16 src[SAMPLES];
+    alignas(16) s16 a[SAMPLES];
+    alignas(16) s16 b[SAMPLES];
+    bool ok = true;
+
+    bool was_muted = false;
+
+    // Long enough to mute on the clipped stretch, and to recover after.
+    for (u32 i = 0; i < 200; i++) {
+        FillBursts(src, SAMPLES, i);
+
+        if (i >= 40 && i < 60) {
+            for (size_t j = 0; j < SAMPLES; j++)
+                src[j] = src[j] < 0 ? -32768 : 32767;
+        }
+
+        DspApplyLimiter(a, src, SAMPLES, &state_a);
+        DspApplyLimiterScalar(b, src, SAMPLES, &state_b);
+        ok = ok && memcmp(a, b, sizeof(a)) == 0 && memcmp(&state_a, &state_b, sizeof(state_a)) == 0;
+        was_muted = was_muted || state_a.is_muted;
+    }
+
+    return BenchCheck(is_limited ? "limiter matches scalar reference" : "safety detector matches scalar reference",
+        ok && was_muted && !state_a.is_muted);
+}
+
+static bool CheckCeiling()
+{
+    DspLimiterState state = InitialState(true);
+    alignas(16) s16 src[SAMPLES];
+    alignas(16) s16 out[SAMPLES];
+    s32 peak_in = 0;
+    s32 peak_out = 0;
+
+    for (u32 i = 0; i < 64; i++) {
+        FillBursts(src, SAMPLES, i);
+        DspApplyLimiter(out, src, SAMPLES, &state);
+
+        for (size_t j = 0; j < SAMPLES; j++) {
+            s32 in = src[j] < 0 ? -src[j] : src[j];
+            s32 o = out[j] < 0 ? -out[j] : out[j];
+            peak_in = in > peak_in ? in : peak_in;
+            peak_out = o > peak_out ? o : peak_out;
+        }
+    }
+
+    printf("bursts: peak in %d, out %d, ceiling %d, muted %s\n",
+        (int)peak_in, (int)peak_out, CEILING, state.is_muted ? "yes" : "no");
+
+    return BenchCheck("limiter holds the ceiling", peak_out <= CEILING + 1 && !state.is_muted);
+}
+
+// Feeds `fill` until the mute flips to `is_muted`; returns how long it took,
+// in milliseconds, or -1 if it never did within `max_ms`.
+template<typename F>
+static int TimeToMute(DspLimiterState* state, bool is_muted, u32 max_ms, F fill)
+{
+    alignas(16) s16 src[SAMPLES];
+    alignas(16) s16 out[SAMPLES];
+    u32 frames = 0;
+
+    while (frames * 1000ull / RATE < max_ms) {
+        fill(src, frames);
+        DspApplyLimiter(out, src, SAMPLES, state);
+        frames += SAMPLES / 2;
+
+        if (state->is_muted == is_muted)
+            return (int)(frames * 1000ull / RATE);
+    }
+
+    return -1;
+}
+
+static bool CheckSafetyMute(bool is_limited)
+{
+    const char* limited = is_limited ? ", limited" : "";
+    char what[64];
+    bool ok = true;
+
+    auto quiet = [](s16* pcm, u32 frames) { FillBursts(pcm, SAMPLES, frames); };
+    auto clipped = [](s16* pcm, u32 frames) {
+        for (size_t i = 0; i < SAMPLES; i++)
+            pcm[i] = (i & 2) ? -32768 : 32767;
+    };
+    auto dc = [](s16* pcm, u32 frames) {
+        BenchFillNoise(pcm, SAMPLES, frames);
+
+        for (size_t i = 0; i < SAMPLES; i++)
+            pcm[i] = 12000 + pcm[i] / 16;
+    };
+
+    DspLimiterState state = InitialState(is_limited);
+    int clean_ms = TimeToMute(&state, true, 2000, quiet);
+    int clip_ms = TimeToMute(&state, true, 1000, clipped);
+    int clip_clear_ms = TimeToMute(&state, false, 5000, quiet);
+
+    printf("full scale%s: muted after %d ms, unmuted %d ms after it stopped\n", limited, clip_ms, clip_clear_ms);
+    snprintf(what, sizeof(what), "no mute on clean bursts%s", limited);
+    ok = BenchCheck(what, clean_ms < 0) && ok;
+    snprintf(what, sizeof(what), "full scale mutes within ~100 ms%s", limited);
+    ok = BenchCheck(what, clip_ms >= 0 && clip_ms <= DSP_SAFETY_TRIP_MS + 30) && ok;
+    snprintf(what, sizeof(what), "full scale mute clears after ~1 s clean%s", limited);
+    ok = BenchCheck(what, clip_clear_ms >= DSP_SAFETY_CLEAR_MS && clip_clear_ms <= DSP_SAFETY_CLEAR_MS + 30) && ok;
+
+    state = InitialState(is_limited);
+    int dc_ms = TimeToMute(&state, true, 1000, dc);
+    int dc_clear_ms = TimeToMute(&state, false, 5000, quiet);
+
+    printf("dc%s: muted after %d ms, unmuted %d ms after it stopped\n", limited, dc_ms, dc_clear_ms);
+    snprintf(what, sizeof(what), "dc mutes within ~150 ms%s", limited);
+    ok = BenchCheck(what, dc_ms >= 0 && dc_ms <= DSP_SAFETY_TRIP_MS + 50) && ok;
+    snprintf(what, sizeof(what), "dc mute clears%s", limited);
+    ok = BenchCheck(what, dc_clear_ms >= DSP_SAFETY_CLEAR_MS) && ok;
+
+    return ok;
+}
+
+static bool CheckPeak()
+{
+    alignas(16) s16 pcm[SAMPLES];
+    bool ok = true;
+
+    for (u32 i = 0; i < 64; i++) {
+        BenchFillNoise(pcm, SAMPLES, i);
+
+        for (size_t j = 0; j < SAMPLES; j++)
+            pcm[j] >>= i % 16;
+
+        // Full negative scale saturates to the largest magnitude.
+        if (i % 4 == 0)
+            pcm[i * 7 % SAMPLES] = -32768;
+
+        ok = ok && DspPeak(pcm, SAMPLES) == DspPeakScalar(pcm, SAMPLES);
+    }
+
+    return BenchCheck("peak matches scalar reference", ok);
+}
+
+int main()
+{
+    BenchCounter counter;
+    alignas(16) s16 pcm[SAMPLES];
+    alignas(16) s16 out[SAMPLES];
+
+    BenchHeader("limiter", counter);
+
+    bool ok = CheckExact(false);
+    ok = CheckExact(true) && ok;
+    ok = CheckCeiling() && ok;
+    ok = CheckSafetyMute(false) && ok;
+    ok = CheckSafetyMute(true) && ok;
+    ok = CheckPeak() && ok;
+
+    if (!ok)
+        return 1;
+
+    FillBursts(pcm, SAMPLES, 5);
+
+    for (int is_limited = 0; is_limited < 2; is_limited++) {
+        DspLimiterState state = InitialState(is_limited);
+
+        printf("%-28s %8lu\n", is_limited ? "limited" : "safety only", (unsigned long)counter.Measure([&] {
+            DspApplyLimiter(out, pcm, SAMPLES, &state);
+        }));
+    }
+
+    printf("%-28s %8lu\n", "peak", (unsigned long)counter.Measure([&] {
+        DspPeak(pcm, SAMPLES);
+    }));
+
+    return 0;
+}
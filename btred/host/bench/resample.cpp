@@ -0,0 +1,262 @@
+#include <string.h>
+#include <math.h>
+#include <switch.h>
+#include "bt_dsp.h"
+#include "bench.h"
+
+// Polyphase resampler, per 0x400 sample capture period, for each rate an
+// audio out can be started at; 48000 is the drift correction's, a few hundred
+// ppm off 1:1. Quality is checked against a long double-precision windowed
+// sinc, evaluated at the very same positions.
+
+#define IN_RATE 48000
+#define PERIOD_FRAMES 0x200
+#define REFERENCE_HALF 256
+#define DRIFT_PPM 300
+
+static const u32 g_out_rates[] = { 48000, 44100, 32000, 16000 };
+
+struct Resampler {
+    DspResampleFilter filter;
+    std::vector<s16> mem;
+    u64 step;
+
+    // At 1:1, the step is off by DRIFT_PPM, as there'd be no point otherwise.
+    explicit Resampler(u32 out_rate):
+        mem(DspResampleFilterSize(DspResampleTaps(IN_RATE, out_rate))),
+        step((((u64)IN_RATE << 32) + out_rate / 2) / out_rate)
+    {
+        DspResampleFilterInit(&filter, mem.data(), DspResampleTaps(IN_RATE, out_rate), IN_RATE, out_rate);
+
+        if (out_rate == IN_RATE)
+            step += (step / 1000000) * DRIFT_PPM;
+    }
+};
+
+static void FillTone(std::vector<s16>& pcm, double hz, double amp)
+{
+    for (size_t i = 0; i < pcm.size() / 2; i++) {
+        double v = amp * sin(2 * M_PI * hz * i / IN_RATE);
+        pcm[2*i + 0] = (s16)lrint(v);
+        pcm[2*i + 1] = (s16)lrint(-v);
+    }
+}
+
+// Runs the kernel over the whole input, one capture period at a time, the
+// way BtResampler does: unconsumed input is carried over to the next call,
+// and the history starts with enough silence that output n is input time
+// n*step.
+static std::vector<s16> Run(const Resampler& rs, const std::vector<s16>& in, bool scalar)
+{
+    size_t frames = in.size() / 2;
+    std::vector<s16> buf(2 * (rs.filter.taps + PERIOD_FRAMES));
+    std::vector<s16> out(frames * 2);
+    size_t fill = rs.filter.taps / 2 - 1;
+    size_t out_frames = 0;
+    u64 pos = 0;
+
+    for (size_t i = 0; i + PERIOD_FRAMES <= frames; i += PERIOD_FRAMES) {
+        memcpy(&buf[2 * fill], &in[2 * i], PERIOD_FRAMES * 2 * sizeof(s16));
+        fill += PERIOD_FRAMES;
+
+        size_t n = (scalar ? DspResampleScalar : DspResample)(
+            &out[2 * out_frames], frames - out_frames, buf.data(), fill, &rs.filter, &pos, rs.step);
+        out_frames += n;
+
+        size_t used = pos >> 32;
+        memmove(&buf[0], &buf[2 * used], (fill - used) * 2 * sizeof(s16));
+        fill -= used;
+        pos -= (u64)used << 32;
+    }
+
+    out.resize(2 * out_frames);
+    return out;
+}
+
+static double I0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+
+    for (int k = 1; k < 40; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+// The left channel as the kernel's output should be: a 512-tap filter cut off
+// at the output's Nyquist frequency, at input time n*step. Only meaningful
+// REFERENCE_HALF frames away from either end of the input.
+static std::vector<double> Reference(const std::vector<s16>& in, size_t out_frames, u32 out_rate, u64 step)
+{
+    const int half = REFERENCE_HALF;
+    const double beta = 14.0;
+    double cutoff = 0.5 * out_rate / IN_RATE;
+    size_t frames = in.size() / 2;
+    std::vector<double> out(out_frames);
+
+    for (size_t n = 0; n < out_frames; n++) {
+        double t = (double)n * step / 4294967296.0;
+        long first = (long)floor(t) - half + 1;
+        double y = 0;
+
+        for (long k = first; k < first + 2 * half; k++) {
+            if (k < 0 || k >= (long)frames)
+                continue;
+
+            double d = t - k;
+            double x = d / half;
+            double sinc = d == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * d) / (M_PI * d);
+            double window = x * x < 1 ? I0(beta * sqrt(1 - x * x)) / I0(beta) : 0;
+            y += in[2 * k] * sinc * window;
+        }
+
+        out[n] = y;
+    }
+
+    return out;
+}
+
+static double Db(double power_ratio)
+{
+    return 10 * log10(power_ratio);
+}
+
+static bool CheckExact()
+{
+    bool ok = true;
+
+    for (u32 rate : g_out_rates) {
+        Resampler rs(rate);
+        std::vector<s16> in(2 * 16 * PERIOD_FRAMES);
+
+        BenchFillNoise(in.data(), in.size(), rate);
+        in[0] = -32768;
+        in[1] = 32767;
+
+        // Off-nominal steps too, as a drift correction would use.
+        bool ok_rate = true;
+
+        for (s64 ppm : { 0, 500, -500 }) {
+            Resampler nudged(rate);
+            nudged.step = rs.step + (s64)(rs.step / 1000000) * ppm;
+            ok_rate = ok_rate && Run(nudged, in, false) == Run(nudged, in, true);
+        }
+
+        char what[64];
+        snprintf(what, sizeof(what), "48000 -> %u matches scalar reference", rate);
+        ok = BenchCheck(what, ok_rate) && ok;
+    }
+
+    return ok;
+}
+
+static bool CheckQuality()
+{
+    bool ok = true;
+
+    for (u32 rate : g_out_rates) {
+        Resampler rs(rate);
+        double worst_snr = 1e9;
+
+        // Two tones well inside the passband.
+        for (double hz : { 997.0, 0.3 * rate }) {
+            std::vector<s16> in(2 * 24 * PERIOD_FRAMES);
+            FillTone(in, hz, 16384);
+
+            std::vector<s16> out = Run(rs, in, false);
+            std::vector<double> ref = Reference(in, out.size() / 2, rate, rs.step);
+
+            double signal = 0;
+            double noise = 0;
+
+            for (size_t n = 0; n < ref.size(); n++) {
+                double t = (double)n * rs.step / 4294967296.0;
+
+                if (t < REFERENCE_HALF || t + REFERENCE_HALF > in.size() / 2)
+                    continue;
+
+                double e = out[2*n] - ref[n];
+                signal += ref[n] * ref[n];
+                noise += e * e;
+            }
+
+            worst_snr = std::min(worst_snr, Db(signal / noise));
+        }
+
+        printf("48000 -> %-5u taps %-3u SNR vs reference %6.1f dB", rate, rs.filter.taps, worst_snr);
+
+        char what[64];
+        // Q15 coefficients put the floor at about 80 dB.
+        snprintf(what, sizeof(what), "48000 -> %u SNR vs reference >= 75 dB", rate);
+        bool ok_snr = worst_snr >= 75;
+
+        // Nothing lies between the two Nyquist frequencies at 1:1.
+        if (rate == IN_RATE) {
+            printf("\n");
+            ok = BenchCheck(what, ok_snr) && ok;
+            continue;
+        }
+
+        // A tone between the two Nyquist frequencies has to go away, rather
+        // than fold back into the audible band. Off the rates' common
+        // multiples, so that it isn't sampled at its zero crossings.
+        double alias_hz = (rate + IN_RATE) / 4.0 + 101;
+        std::vector<s16> in(2 * 24 * PERIOD_FRAMES);
+        FillTone(in, alias_hz, 16384);
+        std::vector<s16> out = Run(rs, in, false);
+
+        size_t skip = rs.filter.taps;
+        double in_power = 16384.0 * 16384.0 / 2;
+        double out_power = 0;
+
+        for (size_t n = skip; n < out.size() / 2; n++)
+            out_power += (double)out[2*n] * out[2*n];
+
+        out_power /= out.size() / 2 - skip;
+        double alias = Db(out_power / in_power + 1e-30);
+
+        printf(", alias at %5.0f Hz %6.1f dB\n", alias_hz, alias);
+
+        ok = BenchCheck(what, ok_snr) && ok;
+        snprintf(what, sizeof(what), "48000 -> %u alias rejection >= 70 dB", rate);
+        ok = BenchCheck(what, alias <= -70) && ok;
+    }
+
+    return ok;
+}
+
+int main()
+{
+    BenchCounter counter;
+
+    BenchHeader("resample", counter);
+
+    if (!CheckExact() || !CheckQuality())
+        return 1;
+
+    // One capture period in, from a history that already holds the filter's
+    // worth of input, as on the send thread.
+    for (u32 rate : g_out_rates) {
+        Resampler rs(rate);
+        std::vector<s16> src(2 * (rs.filter.taps + PERIOD_FRAMES));
+        std::vector<s16> dst(2 * PERIOD_FRAMES);
+        BenchFillNoise(src.data(), src.size(), 3);
+
+        auto run = [&](bool scalar) {
+            u64 pos = 0;
+            (scalar ? DspResampleScalar : DspResample)(
+                dst.data(), PERIOD_FRAMES, src.data(), src.size() / 2, &rs.filter, &pos, rs.step);
+        };
+
+        char label[64];
+        snprintf(label, sizeof(label), "48000 -> %u", rate);
+        printf("%-28s %8lu\n", label, (unsigned long)counter.Measure([&] { run(false); }, 500));
+        snprintf(label, sizeof(label), "48000 -> %u scalar reference", rate);
+        printf("%-28s %8lu\n", label, (unsigned long)counter.Measure([&] { run(true); }, 500));
+    }
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+// Internal interface of the host mock layer. Nothing in btred/source may
+// include this; it is shared between the mock services and host benchmarks.
+
+#include <vector>
+#include <switch.h>
+
+// Kernel objects (mock_kernel.cpp).
+u64  mockNow();
+MockWaitable* mockWaitableCreate();
+void mockWaitableRetain(MockWaitable* obj);
+void mockWaitableRelease(MockWaitable* obj);
+void mockWaitableSignal(MockWaitable* obj);
+void mockSleepUntil(u64 deadline_ns);
+
+// Scenario knobs, read once from BTRED_HOST_* environment variables.
+struct MockWorldConfig {
+    u64   duration_ns;          // BTRED_HOST_DURATION_MS, 0 = run forever
+    u32   num_headsets;         // BTRED_HOST_HEADSETS
+    u64   connect_delay_ns;     // BTRED_HOST_CONNECT_DELAY_MS
+    u64   connect_step_ns;      // BTRED_HOST_CONNECT_STEP_MS, added per headset
+    u64   render_period_ns;     // BTRED_HOST_RENDER_PERIOD_US
+    u64   send_cost_ns;         // BTRED_HOST_SEND_COST_US
+    u64   send_jitter_ns;       // BTRED_HOST_SEND_JITTER_US
+    u64   send_spike_ns;        // BTRED_HOST_SEND_SPIKE_MS
+    u32   send_spike_every;     // BTRED_HOST_SEND_SPIKE_EVERY (sends)
+    u64   ipc_cost_ns;          // BTRED_HOST_IPC_COST_US
+    u8    volume;               // BTRED_HOST_VOLUME
+    u64   volume_step_ns;       // BTRED_HOST_VOLUME_STEP_MS, 0 = fixed
+    float tone_hz;              // BTRED_HOST_TONE_HZ
+    float tone_amp;             // BTRED_HOST_TONE_AMP
+    u64   silence_every_ns;     // BTRED_HOST_SILENCE_EVERY_MS, the tone pauses, 0 = never
+    u64   silence_for_ns;       // BTRED_HOST_SILENCE_FOR_MS
+    u64   sleep_at_ns;          // BTRED_HOST_SLEEP_AT_MS, 0 = never
+    u64   sleep_for_ns;         // BTRED_HOST_SLEEP_FOR_MS
+    u64   stall_every_ns;       // BTRED_HOST_STALL_EVERY_MS, 0 = never
+    u64   stall_for_ns;         // BTRED_HOST_STALL_FOR_MS
+    u64   power_off_at_ns;      // BTRED_HOST_POWER_OFF_AT_MS, headset 0, 0 = never
+    u64   power_off_for_ns;     // BTRED_HOST_POWER_OFF_FOR_MS
+    u64   boot_delay_ns;        // BTRED_HOST_BOOT_DELAY_MS, until services register
+    u64   audio_ready_ns;       // BTRED_HOST_AUDIO_READY_MS, audio out open -> ready
+    u32   sink_rate;            // BTRED_HOST_SINK_RATE, the only rate audio outs take, 0 = any
+    bool  sink_clock;           // BTRED_HOST_SINK_PPM set: headsets play from a buffer, see mock_btdrv.cpp
+    float sink_ppm;             // BTRED_HOST_SINK_PPM, headset clock offset, positive = fast
+};
+
+const MockWorldConfig& mockConfig();
+
+// Started lazily by btdrvInitialize; ends the process with a report after
+// duration_ns.
+void mockWorldStart();
+void mockWorldReport();
+
+// Synthetic PCM source shared by every recorder: interleaved stereo s16.
+void mockGeneratePcm(u64 first_frame, s16* out, size_t frames);
+
+// Simulated IPC round trip cost for control services.
+void mockIpc();
+
+// What a service's Initialize returns: 0, or an error while the console is
+// still booting and the service isn't registered yet.
+Result mockServiceInit();
+
+// Percentile summary over a sample set, in microseconds.
+struct MockStats {
+    std::vector<u64> samples;
+
+    void Add(u64 v) { samples.push_back(v); }
+    void Print(const char* label);
+};
+
+// Per-service reports, called from mockWorldReport.
+void mockAudrecReport();
+void mockBtdrvReport();
+void mockServicesReport();
+void mockKernelReport();
+
+// Hooks between services.
+void mockBtdrvSetAllConnected(bool connected, u64 delay_ns);
+void mockBtdrvNoteWake();
+void mockBtdrvSetPowered(u32 headset, bool powered);
+void mockPscRequest(PscPmState state);
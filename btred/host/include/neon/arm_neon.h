@@ -0,0 +1,354 @@
+#pragma once
+
+// Scalar emulation of the NEON intrinsics used by btred, for hosts without
+// Advanced SIMD (x86-64). Only put on the include path when building for a
+// non-aarch64 host; on aarch64 the toolchain's own arm_neon.h is used.
+//
+// Every intrinsic follows the ARM pseudo-code semantics (saturation,
+// rounding, truncation), so kernels can be checked for bit-exactness against
+// their scalar references on any host. Timings taken with this header are
+// meaningless; benchmark on aarch64.
+
+#include <stdint.h>
+#include <math.h>
+
+typedef int16_t int16x4_t   __attribute__((vector_size(8)));
+typedef int16_t int16x8_t   __attribute__((vector_size(16)));
+typedef int32_t int32x4_t   __attribute__((vector_size(16)));
+typedef float   float32x2_t __attribute__((vector_size(8)));
+typedef float   float32x4_t __attribute__((vector_size(16)));
+
+struct int16x8x2_t { int16x8_t val[2]; };
+
+#define NEON_SHIM static inline __attribute__((always_inline))
+
+namespace neon_shim {
+
+NEON_SHIM int16_t sat16(int64_t x)
+{
+    return x > INT16_MAX ? INT16_MAX : x < INT16_MIN ? INT16_MIN : (int16_t)x;
+}
+
+NEON_SHIM int32_t sat32(int64_t x)
+{
+    return x > INT32_MAX ? INT32_MAX : x < INT32_MIN ? INT32_MIN : (int32_t)x;
+}
+
+NEON_SHIM int32_t f32_to_s32(float x)
+{
+    // FCVTZS: round towards zero, saturate, NaN -> 0.
+    if (x != x)
+        return 0;
+    if (x >= 2147483648.0f)
+        return INT32_MAX;
+    if (x < -2147483648.0f)
+        return INT32_MIN;
+    return (int32_t)x;
+}
+
+NEON_SHIM int32_t f32_to_s32_nearest(float x)
+{
+    // FCVTNS: round to nearest, ties to even, saturate, NaN -> 0.
+    if (x != x)
+        return 0;
+    if (x >= 2147483648.0f)
+        return INT32_MAX;
+    if (x < -2147483648.0f)
+        return INT32_MIN;
+    return (int32_t)nearbyintf(x);
+}
+
+}
+
+NEON_SHIM int16x4_t vld1_s16(const int16_t* p)
+{
+    int16x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = p[i];
+    return r;
+}
+
+NEON_SHIM void vst1_s16(int16_t* p, int16x4_t v)
+{
+    for (int i = 0; i < 4; i++) p[i] = v[i];
+}
+
+NEON_SHIM int32x4_t vmovl_s16(int16x4_t v)
+{
+    int32x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = v[i];
+    return r;
+}
+
+NEON_SHIM int16x4_t vqmovn_s32(int32x4_t v)
+{
+    int16x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = neon_shim::sat16(v[i]);
+    return r;
+}
+
+NEON_SHIM float32x4_t vcvtq_f32_s32(int32x4_t v)
+{
+    float32x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = (float)v[i];
+    return r;
+}
+
+NEON_SHIM int32x4_t vcvtq_s32_f32(float32x4_t v)
+{
+    int32x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = neon_shim::f32_to_s32(v[i]);
+    return r;
+}
+
+NEON_SHIM float32x4_t vmulq_n_f32(float32x4_t v, float s)
+{
+    float32x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = v[i] * s;
+    return r;
+}
+
+NEON_SHIM int16x8_t vld1q_s16(const int16_t* p)
+{
+    int16x8_t r;
+    for (int i = 0; i < 8; i++) r[i] = p[i];
+    return r;
+}
+
+NEON_SHIM void vst1q_s16(int16_t* p, int16x8_t v)
+{
+    for (int i = 0; i < 8; i++) p[i] = v[i];
+}
+
+NEON_SHIM int16x8x2_t vld2q_s16(const int16_t* p)
+{
+    // LD2: de-interleaves even elements into val[0], odd into val[1].
+    int16x8x2_t r;
+    for (int i = 0; i < 8; i++) {
+        r.val[0][i] = p[2*i + 0];
+        r.val[1][i] = p[2*i + 1];
+    }
+    return r;
+}
+
+NEON_SHIM int32x4_t vld1q_s32(const int32_t* p)
+{
+    int32x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = p[i];
+    return r;
+}
+
+NEON_SHIM int16x8_t vdupq_n_s16(int16_t s)
+{
+    int16x8_t r;
+    for (int i = 0; i < 8; i++) r[i] = s;
+    return r;
+}
+
+NEON_SHIM int32x4_t vdupq_n_s32(int32_t s)
+{
+    int32x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = s;
+    return r;
+}
+
+NEON_SHIM int32x4_t vaddq_s32(int32x4_t a, int32x4_t b)
+{
+    int32x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = (int32_t)((uint32_t)a[i] + (uint32_t)b[i]);
+    return r;
+}
+
+NEON_SHIM int16x8_t vaddq_s16(int16x8_t a, int16x8_t b)
+{
+    int16x8_t r;
+    for (int i = 0; i < 8; i++) r[i] = (int16_t)((uint16_t)a[i] + (uint16_t)b[i]);
+    return r;
+}
+
+NEON_SHIM int32x4_t vmlal_s16(int32x4_t acc, int16x4_t a, int16x4_t b)
+{
+    int32x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = (int32_t)((uint32_t)acc[i] + (uint32_t)((int32_t)a[i] * b[i]));
+    return r;
+}
+
+NEON_SHIM int32_t vaddvq_s32(int32x4_t v)
+{
+    return (int32_t)((uint32_t)v[0] + (uint32_t)v[1] + (uint32_t)v[2] + (uint32_t)v[3]);
+}
+
+NEON_SHIM int16x4_t vget_low_s16(int16x8_t v)
+{
+    int16x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = v[i];
+    return r;
+}
+
+NEON_SHIM int16x4_t vget_high_s16(int16x8_t v)
+{
+    int16x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = v[i + 4];
+    return r;
+}
+
+NEON_SHIM int16x8_t vcombine_s16(int16x4_t lo, int16x4_t hi)
+{
+    int16x8_t r;
+    for (int i = 0; i < 4; i++) {
+        r[i] = lo[i];
+        r[i + 4] = hi[i];
+    }
+    return r;
+}
+
+NEON_SHIM int16x4_t vshrn_n_s32(int32x4_t v, const int n)
+{
+    int16x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = (int16_t)(v[i] >> n);
+    return r;
+}
+
+NEON_SHIM int16x8_t vqrdmulhq_s16(int16x8_t a, int16x8_t b)
+{
+    // SQRDMULH: sat((2*a*b + (1 << 15)) >> 16)
+    int16x8_t r;
+    for (int i = 0; i < 8; i++)
+        r[i] = neon_shim::sat16((2 * (int64_t)a[i] * b[i] + (1 << 15)) >> 16);
+    return r;
+}
+
+NEON_SHIM int16x8_t vrhaddq_s16(int16x8_t a, int16x8_t b)
+{
+    // SRHADD: (a + b + 1) >> 1, in wider precision.
+    int16x8_t r;
+    for (int i = 0; i < 8; i++) r[i] = (int16_t)(((int32_t)a[i] + b[i] + 1) >> 1);
+    return r;
+}
+
+NEON_SHIM int16x8_t vrev32q_s16(int16x8_t v)
+{
+    int16x8_t r;
+    for (int i = 0; i < 8; i++) r[i] = v[i ^ 1];
+    return r;
+}
+
+NEON_SHIM int16x8_t vtrn1q_s16(int16x8_t a, int16x8_t b)
+{
+    int16x8_t r;
+    for (int i = 0; i < 8; i += 2) {
+        r[i] = a[i];
+        r[i + 1] = b[i];
+    }
+    return r;
+}
+
+NEON_SHIM int16x8_t vtrn2q_s16(int16x8_t a, int16x8_t b)
+{
+    int16x8_t r;
+    for (int i = 0; i < 8; i += 2) {
+        r[i] = a[i + 1];
+        r[i + 1] = b[i + 1];
+    }
+    return r;
+}
+
+NEON_SHIM int16x8_t vqabsq_s16(int16x8_t v)
+{
+    int16x8_t r;
+    for (int i = 0; i < 8; i++) r[i] = neon_shim::sat16(v[i] < 0 ? -(int32_t)v[i] : v[i]);
+    return r;
+}
+
+NEON_SHIM int16_t vmaxvq_s16(int16x8_t v)
+{
+    int16_t r = v[0];
+    for (int i = 1; i < 8; i++) r = v[i] > r ? v[i] : r;
+    return r;
+}
+
+NEON_SHIM int32_t vaddlvq_s16(int16x8_t v)
+{
+    int32_t r = 0;
+    for (int i = 0; i < 8; i++) r += v[i];
+    return r;
+}
+
+NEON_SHIM float32x4_t vld1q_f32(const float* p)
+{
+    float32x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = p[i];
+    return r;
+}
+
+NEON_SHIM void vst1q_f32(float* p, float32x4_t v)
+{
+    for (int i = 0; i < 4; i++) p[i] = v[i];
+}
+
+NEON_SHIM float32x2_t vget_low_f32(float32x4_t v)
+{
+    float32x2_t r = { v[0], v[1] };
+    return r;
+}
+
+NEON_SHIM float32x2_t vget_high_f32(float32x4_t v)
+{
+    float32x2_t r = { v[2], v[3] };
+    return r;
+}
+
+NEON_SHIM float32x4_t vcombine_f32(float32x2_t lo, float32x2_t hi)
+{
+    float32x4_t r = { lo[0], lo[1], hi[0], hi[1] };
+    return r;
+}
+
+NEON_SHIM float32x4_t vdupq_n_f32(float s)
+{
+    float32x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = s;
+    return r;
+}
+
+NEON_SHIM float32x2_t vmul_n_f32(float32x2_t v, float s)
+{
+    float32x2_t r;
+    for (int i = 0; i < 2; i++) r[i] = v[i] * s;
+    return r;
+}
+
+NEON_SHIM float32x2_t vfma_n_f32(float32x2_t acc, float32x2_t v, float s)
+{
+    // FMLA: acc + v * s, rounded once.
+    float32x2_t r;
+    for (int i = 0; i < 2; i++) r[i] = fmaf(v[i], s, acc[i]);
+    return r;
+}
+
+NEON_SHIM float32x4_t vminq_f32(float32x4_t a, float32x4_t b)
+{
+    float32x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = a[i] < b[i] ? a[i] : b[i];
+    return r;
+}
+
+NEON_SHIM float32x4_t vmaxq_f32(float32x4_t a, float32x4_t b)
+{
+    float32x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = a[i] > b[i] ? a[i] : b[i];
+    return r;
+}
+
+NEON_SHIM int32x4_t vcvtnq_s32_f32(float32x4_t v)
+{
+    int32x4_t r;
+    for (int i = 0; i < 4; i++) r[i] = neon_shim::f32_to_s32_nearest(v[i]);
+    return r;
+}
+
+NEON_SHIM int16x8_t vmaxq_s16(int16x8_t a, int16x8_t b)
+{
+    int16x8_t r;
+    for (int i = 0; i < 8; i++) r[i] = a[i] > b[i] ? a[i] : b[i];
+    return r;
+}
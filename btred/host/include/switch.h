@@ -0,0 +1,413 @@
+#pragma once
+
+// Host stand-in for the subset of libnx used by btred.
+//
+// Types and signatures mirror libnx so that btred/source compiles unmodified.
+// The implementations live in btred/host/source and are driven by the mock
+// world (see mock.h): a synthetic audio renderer clock feeding audrec, and a
+// fake Bluetooth sink that records timing.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t   s8;
+typedef int16_t  s16;
+typedef int32_t  s32;
+typedef int64_t  s64;
+typedef u32 Result;
+typedef u32 Handle;
+
+#define NORETURN __attribute__((noreturn))
+#define NX_INLINE __attribute__((always_inline)) static inline
+
+#define R_SUCCEEDED(res)  ((res) == 0)
+#define R_FAILED(res)     ((res) != 0)
+#define R_MODULE(res)     ((res) & 0x1FF)
+#define R_DESCRIPTION(res) (((res) >> 9) & 0x1FFF)
+#define MAKERESULT(module, description) \
+    ((((module) & 0x1FF)) | ((description) & 0x1FFF) << 9)
+
+enum {
+    Module_Kernel = 1,
+    Module_Libnx  = 345,
+};
+
+enum {
+    KernelError_TimedOut  = 117,
+    KernelError_Cancelled = 118,
+};
+
+enum {
+    LibnxError_NotInitialized = 7,
+    LibnxError_NotFound       = 35,
+    LibnxError_BadInput       = 40,
+};
+
+#define KERNELRESULT(desc) MAKERESULT(Module_Kernel, KernelError_##desc)
+
+//---------------------------------------------------------------------------
+// arm / svc
+//---------------------------------------------------------------------------
+
+u64  armGetSystemTick(void);
+u64  armGetSystemTickFreq(void);
+u64  armNsToTicks(u64 ns);
+u64  armTicksToNs(u64 tick);
+
+u64  svcGetSystemTick(void);
+void svcSleepThread(s64 nano);
+void NORETURN svcExitProcess(void);
+
+u64  randomGet64(void);
+
+//---------------------------------------------------------------------------
+// Synchronization
+//---------------------------------------------------------------------------
+
+typedef pthread_mutex_t Mutex;
+
+NX_INLINE void mutexInit(Mutex* m) { pthread_mutex_init(m, NULL); }
+NX_INLINE void mutexLock(Mutex* m) { pthread_mutex_lock(m); }
+NX_INLINE bool mutexTryLock(Mutex* m) { return pthread_mutex_trylock(m) == 0; }
+NX_INLINE void mutexUnlock(Mutex* m) { pthread_mutex_unlock(m); }
+
+typedef struct MockWaitable MockWaitable;
+
+typedef struct {
+    MockWaitable* obj;
+    bool autoclear;
+} Event;
+
+Result eventCreate(Event* t, bool autoclear);
+Result eventWait(Event* t, u64 timeout);
+Result eventFire(Event* t);
+Result eventClear(Event* t);
+void   eventClose(Event* t);
+
+typedef struct {
+    bool signal;
+    bool auto_clear;
+} UEvent;
+
+void ueventCreate(UEvent* e, bool auto_clear);
+void ueventClear(UEvent* e);
+void ueventSignal(UEvent* e);
+
+typedef enum {
+    TimerType_OneShot,
+    TimerType_Repeating,
+} TimerType;
+
+typedef struct {
+    TimerType type;
+    bool started;
+    u64 next_tick;
+    u64 interval;
+} UTimer;
+
+void utimerCreate(UTimer* t, u64 interval, TimerType type);
+void utimerStart(UTimer* t);
+void utimerStop(UTimer* t);
+
+typedef enum {
+    WaiterType_Event,
+    WaiterType_UEvent,
+    WaiterType_UTimer,
+} WaiterType;
+
+typedef struct {
+    WaiterType type;
+    void* obj;
+} Waiter;
+
+NX_INLINE Waiter waiterForEvent(Event* e) { return Waiter{WaiterType_Event, e}; }
+NX_INLINE Waiter waiterForUEvent(UEvent* e) { return Waiter{WaiterType_UEvent, e}; }
+NX_INLINE Waiter waiterForUTimer(UTimer* t) { return Waiter{WaiterType_UTimer, t}; }
+
+Result waitObjects(s32* idx_out, const Waiter* objects, s32 num_objects, u64 timeout);
+
+#define waitMulti(idx_out, timeout, ...) ({ \
+    Waiter __objects[] = { __VA_ARGS__ }; \
+    waitObjects((idx_out), __objects, sizeof(__objects) / sizeof(Waiter), (timeout)); \
+})
+
+//---------------------------------------------------------------------------
+// Threads
+//---------------------------------------------------------------------------
+
+typedef void (*ThreadFunc)(void*);
+
+typedef struct {
+    pthread_t pthread;
+    ThreadFunc entry;
+    void* arg;
+    void* stack_mem;
+    size_t stack_sz;
+    int prio;
+    int cpuid;
+    bool started;
+} Thread;
+
+Result threadCreate(Thread* t, ThreadFunc entry, void* arg, void* stack_mem, size_t stack_sz, int prio, int cpuid);
+Result threadStart(Thread* t);
+Result threadWaitForExit(Thread* t);
+Result threadClose(Thread* t);
+
+//---------------------------------------------------------------------------
+// fatal
+//---------------------------------------------------------------------------
+
+typedef enum {
+    FatalPolicy_ErrorReportAndErrorScreen = 0,
+    FatalPolicy_ErrorReport = 1,
+    FatalPolicy_ErrorScreen = 2,
+} FatalPolicy;
+
+typedef struct {
+    u64 x[29];
+    u64 fp;
+    u64 lr;
+    u64 sp;
+    u64 pc;
+    u64 pstate;
+    u64 afsr0;
+    u64 afsr1;
+    u64 esr;
+    u64 far;
+    u64 stack_trace[32];
+    u64 start_address;
+    u64 register_set_flags;
+    u32 stack_trace_size;
+} FatalAarch64Context;
+
+typedef struct {
+    FatalAarch64Context aarch64_ctx;
+    bool is_aarch32;
+    u32 type;
+} FatalCpuContext;
+
+void NORETURN fatalThrow(Result err);
+void NORETURN fatalThrowWithContext(Result err, FatalPolicy type, FatalCpuContext* ctx);
+
+//---------------------------------------------------------------------------
+// applet
+//---------------------------------------------------------------------------
+
+typedef enum {
+    AppletType_None = -2,
+    AppletType_Default = -1,
+    AppletType_Application = 0,
+} AppletType;
+
+//---------------------------------------------------------------------------
+// btdrv
+//---------------------------------------------------------------------------
+
+typedef struct {
+    u8 address[0x6];
+} BtdrvAddress;
+
+typedef struct {
+    u32 unk_x0;
+    u32 sample_rate;
+    u32 bits_per_sample;
+} BtdrvPcmParameter;
+
+typedef enum {
+    BtdrvAudioOutState_Stopped = 0,
+    BtdrvAudioOutState_Started = 1,
+} BtdrvAudioOutState;
+
+typedef struct {
+    BtdrvAddress addr;
+    char name[0x20];
+    u8 class_of_device[0x3];
+    u8 link_key[0x10];
+    u8 link_key_present;
+    u16 version;
+    u32 trusted_services;
+    u16 vid;
+    u16 pid;
+    u8 sub_class;
+    u8 attribute_mask;
+    u16 descriptor_length;
+    u8 descriptor[0x80];
+    u8 key_type;
+    u8 device_type;
+    u16 brr_size;
+    u8 brr[0x9];
+    u8 reserved[0x12F];
+} SetSysBluetoothDevicesSettings;
+
+Result btdrvInitialize(void);
+void   btdrvExit(void);
+
+Result btdrvAcquireAudioConnectionStateChangedEvent(Event* out_event, bool autoclear);
+Result btdrvAcquireAudioEvent(Event* out_event, bool autoclear);
+Result btdrvGetConnectedAudioDevice(BtdrvAddress* addrs, s32 count, s32* total_out);
+Result btdrvOpenAudioConnection(BtdrvAddress addr);
+Result btdrvCloseAudioConnection(BtdrvAddress addr);
+Result btdrvGetPairedDeviceInfo(BtdrvAddress addr, SetSysBluetoothDevicesSettings* settings);
+Result btdrvAddPairedDeviceInfo(const SetSysBluetoothDevicesSettings* settings);
+
+Result btdrvOpenAudioOut(BtdrvAddress addr, u32* audio_handle);
+Result btdrvCloseAudioOut(u32 audio_handle);
+Result btdrvAcquireAudioOutStateChangedEvent(u32 audio_handle, Event* out_event, bool autoclear);
+Result btdrvGetAudioOutState(u32 audio_handle, BtdrvAudioOutState* out);
+Result btdrvStartAudioOut(u32 audio_handle, const BtdrvPcmParameter* pcm_param, s64 in_latency, s64* out_latency, u64* out1);
+Result btdrvStopAudioOut(u32 audio_handle);
+Result btdrvSendAudioData(u32 audio_handle, const void* buffer, u64 size, u64* transferred_size);
+
+//---------------------------------------------------------------------------
+// audrec
+//---------------------------------------------------------------------------
+
+typedef struct MockRecorder MockRecorder;
+
+typedef struct {
+    MockRecorder* impl;
+} AudrecRecorder;
+
+typedef struct {
+    u32 sample_rate;
+    u32 channel_count;
+} FinalOutputRecorderParameter;
+
+typedef struct {
+    u32 sample_rate;
+    u32 channel_count;
+    u32 sample_format;
+    u32 state;
+} FinalOutputRecorderParameterInternal;
+
+typedef struct {
+    u64 released_ns;
+    u64 next_buffer_ptr;
+    u64 sample_buffer_ptr;
+    u64 sample_buffer_capacity;
+    u64 data_size;
+    u64 data_offset;
+} FinalOutputRecorderBuffer;
+
+Result audrecInitialize(void);
+void   audrecExit(void);
+
+Result audrecOpenFinalOutputRecorder(AudrecRecorder* recorder_out, FinalOutputRecorderParameter* param_in, u64 aruid, FinalOutputRecorderParameterInternal* param_out);
+Result audrecRecorderStart(AudrecRecorder* recorder);
+Result audrecRecorderStop(AudrecRecorder* recorder);
+Result audrecRecorderRegisterBufferEvent(AudrecRecorder* recorder, Event* out_event);
+Result audrecRecorderAppendFinalOutputRecorderBuffer(AudrecRecorder* recorder, u64 buffer_client_ptr, FinalOutputRecorderBuffer* param);
+Result audrecRecorderGetReleasedFinalOutputRecorderBuffers(AudrecRecorder* recorder, u64* out_buffers, u64* inout_count, u64* out_released);
+void   audrecRecorderClose(AudrecRecorder* recorder);
+
+//---------------------------------------------------------------------------
+// set:sys
+//---------------------------------------------------------------------------
+
+typedef enum {
+    SetSysAudioDevice_Console = 0,
+    SetSysAudioDevice_Headphone = 1,
+    SetSysAudioDevice_Bluetooth = 2,
+} SetSysAudioDevice;
+
+typedef struct {
+    u8 unk_x0;
+    u8 volume;
+} SetSysAudioVolume;
+
+Result setsysInitialize(void);
+void   setsysExit(void);
+Result setsysGetAudioVolume(SetSysAudioDevice device, SetSysAudioVolume* out);
+
+//---------------------------------------------------------------------------
+// audctl
+//---------------------------------------------------------------------------
+
+Result audctlInitialize(void);
+void   audctlExit(void);
+Result audctlSetSystemOutputMasterVolume(float volume);
+
+//---------------------------------------------------------------------------
+// psc:m
+//---------------------------------------------------------------------------
+
+typedef enum {
+    PscPmState_Awake = 0,
+    PscPmState_ReadyAwaken = 1,
+    PscPmState_ReadySleep = 2,
+    PscPmState_ReadySleepCritical = 3,
+    PscPmState_ReadyAwakenCritical = 4,
+    PscPmState_ReadyShutdown = 5,
+} PscPmState;
+
+typedef enum {
+    PscPmModuleId_Usb = 4,
+    PscPmModuleId_Ethernet = 5,
+    PscPmModuleId_Fgm = 6,
+    PscPmModuleId_PcvClock = 7,
+    PscPmModuleId_PcvVoltage = 8,
+    PscPmModuleId_Gpio = 9,
+    PscPmModuleId_Pinmux = 10,
+    PscPmModuleId_Uart = 11,
+    PscPmModuleId_I2c = 12,
+    PscPmModuleId_I2cPcv = 13,
+    PscPmModuleId_Spi = 14,
+    PscPmModuleId_Pwm = 15,
+    PscPmModuleId_Psm = 16,
+    PscPmModuleId_Tc = 17,
+    PscPmModuleId_Omm = 18,
+    PscPmModuleId_Pcie = 19,
+    PscPmModuleId_Lbl = 20,
+    PscPmModuleId_Display = 21,
+    PscPmModuleId_Hid = 24,
+    PscPmModuleId_WlanSockets = 25,
+    PscPmModuleId_Fs = 27,
+    PscPmModuleId_Audio = 28,
+    PscPmModuleId_TmaHostIo = 30,
+    PscPmModuleId_Bluetooth = 31,
+    PscPmModuleId_Bpc = 32,
+    PscPmModuleId_Fan = 33,
+    PscPmModuleId_Pcm = 34,
+    PscPmModuleId_Nfc = 35,
+    PscPmModuleId_Apm = 36,
+    PscPmModuleId_Btm = 37,
+    PscPmModuleId_Nifm = 38,
+    PscPmModuleId_GpioLow = 39,
+    PscPmModuleId_Npns = 40,
+    PscPmModuleId_Lm = 41,
+    PscPmModuleId_Bcat = 42,
+    PscPmModuleId_Time = 43,
+    PscPmModuleId_Pctl = 44,
+    PscPmModuleId_Erpt = 45,
+    PscPmModuleId_Eupld = 46,
+    PscPmModuleId_Friends = 47,
+    PscPmModuleId_Bgtc = 48,
+    PscPmModuleId_Account = 49,
+    PscPmModuleId_Sasbus = 50,
+    PscPmModuleId_Ntc = 51,
+    PscPmModuleId_Idle = 52,
+    PscPmModuleId_Tcap = 53,
+    PscPmModuleId_PsmLow = 54,
+    PscPmModuleId_Ndd = 55,
+    PscPmModuleId_Olsc = 56,
+    PscPmModuleId_Ns = 61,
+} PscPmModuleId;
+
+typedef struct {
+    Event event;
+    PscPmModuleId module_id;
+} PscPmModule;
+
+Result pscmInitialize(void);
+void   pscmExit(void);
+Result pscmGetPmModule(PscPmModule* out, PscPmModuleId module_id, const u32* dependencies, u32 dependency_count, bool autoclear);
+Result pscPmModuleGetRequest(PscPmModule* module, PscPmState* out_state, u32* out_flags);
+Result pscPmModuleAcknowledge(PscPmModule* module, PscPmState state);
+Result pscPmModuleFinalize(PscPmModule* module);
+void   pscPmModuleClose(PscPmModule* module);
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include "mock.h"
+
+// audrec:u stand-in. A single renderer clock thread produces the final mix
+// in render_period_ns chunks and appends it to the front buffer of every
+// started recorder. A buffer is released (and the recorder's buffer event
+// signaled) once it is full; if a recorder has no buffer queued, the chunk
+// is dropped, as the real service does.
+//
+// With BTRED_HOST_STALL_EVERY_MS the renderer periodically stalls (as it
+// does around app switches) and then catches up in a burst. Buffers are
+// stamped with the time their audio was due, so a burst shows up as several
+// buffers released at once, with a lagging timestamp.
+
+struct MockRecorder {
+    bool started;
+    std::deque<FinalOutputRecorderBuffer> queued;
+    u64 fill;
+    std::vector<u64> released;
+    u64 last_released_ns;
+    MockWaitable* event;
+};
+
+static std::mutex g_audrec_lock;
+static std::vector<MockRecorder*> g_recorders;
+static u32  g_audrec_refs;
+static bool g_renderer_started;
+
+static u64 g_stat_opens;
+static u64 g_stat_released;
+static u64 g_stat_dropped_frames;
+static u64 g_stat_get_calls;
+static u64 g_stat_append_calls;
+
+static void RendererThread()
+{
+    const MockWorldConfig& cfg = mockConfig();
+    const size_t frames = (size_t)((cfg.render_period_ns * 48000) / 1000000000ULL);
+
+    std::vector<s16> mix(frames * 2);
+    u64 frame_pos = 0;
+    u64 next = mockNow() + cfg.render_period_ns;
+
+    u64 start = next;
+
+    while (true) {
+        u64 due = next;
+        u64 wake = due;
+        next += cfg.render_period_ns;
+
+        if (cfg.stall_every_ns != 0) {
+            u64 phase = (due - start) % cfg.stall_every_ns;
+            u64 stall_start = cfg.stall_every_ns - cfg.stall_for_ns;
+
+            if (phase >= stall_start)
+                wake = due - phase + cfg.stall_every_ns;
+        }
+
+        mockSleepUntil(wake);
+
+        mockGeneratePcm(frame_pos, mix.data(), frames);
+        frame_pos += frames;
+
+        std::lock_guard<std::mutex> lk(g_audrec_lock);
+
+        for (MockRecorder* r : g_recorders) {
+            if (!r->started)
+                continue;
+
+            size_t src_off = 0;
+            size_t src_left = frames * 2 * sizeof(s16);
+
+            while (src_left > 0) {
+                if (r->queued.empty()) {
+                    g_stat_dropped_frames += src_left / (2 * sizeof(s16));
+                    break;
+                }
+
+                FinalOutputRecorderBuffer& buf = r->queued.front();
+                size_t n = std::min<size_t>(src_left, buf.data_size - r->fill);
+
+                memcpy((u8*)buf.sample_buffer_ptr + buf.data_offset + r->fill, (u8*)mix.data() + src_off, n);
+                r->fill += n;
+                src_off += n;
+                src_left -= n;
+
+                if (r->fill == buf.data_size) {
+                    r->released.push_back(buf.sample_buffer_ptr);
+                    r->last_released_ns = due;
+                    r->queued.pop_front();
+                    r->fill = 0;
+                    g_stat_released++;
+                    mockWaitableSignal(r->event);
+                }
+            }
+        }
+    }
+}
+
+Result audrecInitialize(void)
+{
+    std::lock_guard<std::mutex> lk(g_audrec_lock);
+    Result rc = mockServiceInit();
+
+    if (R_FAILED(rc))
+        return rc;
+
+    g_audrec_refs++;
+
+    if (!g_renderer_started) {
+        std::thread(RendererThread).detach();
+        g_renderer_started = true;
+    }
+
+    return 0;
+}
+
+void audrecExit(void)
+{
+    std::lock_guard<std::mutex> lk(g_audrec_lock);
+
+    if (g_audrec_refs > 0)
+        g_audrec_refs--;
+}
+
+Result audrecOpenFinalOutputRecorder(AudrecRecorder* recorder_out, FinalOutputRecorderParameter* param_in, u64 aruid, FinalOutputRecorderParameterInternal* param_out)
+{
+    std::lock_guard<std::mutex> lk(g_audrec_lock);
+    mockIpc();
+
+    if (g_audrec_refs == 0)
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    MockRecorder* r = new MockRecorder;
+    r->started = false;
+    r->fill = 0;
+    r->last_released_ns = 0;
+    r->event = mockWaitableCreate();
+    g_recorders.push_back(r);
+    g_stat_opens++;
+
+    recorder_out->impl = r;
+
+    param_out->sample_rate = 48000;
+    param_out->channel_count = 2;
+    param_out->sample_format = 2;
+    param_out->state = 0;
+    return 0;
+}
+
+Result audrecRecorderStart(AudrecRecorder* recorder)
+{
+    std::lock_guard<std::mutex> lk(g_audrec_lock);
+    mockIpc();
+    recorder->impl->started = true;
+    return 0;
+}
+
+Result audrecRecorderStop(AudrecRecorder* recorder)
+{
+    std::lock_guard<std::mutex> lk(g_audrec_lock);
+    mockIpc();
+    recorder->impl->started = false;
+    return 0;
+}
+
+Result audrecRecorderRegisterBufferEvent(AudrecRecorder* recorder, Event* out_event)
+{
+    std::lock_guard<std::mutex> lk(g_audrec_lock);
+    mockIpc();
+    mockWaitableRetain(recorder->impl->event);
+    out_event->obj = recorder->impl->event;
+    out_event->autoclear = true;
+    return 0;
+}
+
+Result audrecRecorderAppendFinalOutputRecorderBuffer(AudrecRecorder* recorder, u64 buffer_client_ptr, FinalOutputRecorderBuffer* param)
+{
+    std::lock_guard<std::mutex> lk(g_audrec_lock);
+    mockIpc();
+    g_stat_append_calls++;
+
+    if (param->data_size == 0 || param->data_size % (2 * sizeof(s16)) != 0)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    recorder->impl->queued.push_back(*param);
+    return 0;
+}
+
+Result audrecRecorderGetReleasedFinalOutputRecorderBuffers(AudrecRecorder* recorder, u64* out_buffers, u64* inout_count, u64* out_released)
+{
+    std::lock_guard<std::mutex> lk(g_audrec_lock);
+    mockIpc();
+    g_stat_get_calls++;
+
+    MockRecorder* r = recorder->impl;
+    u64 n = std::min<u64>(*inout_count, r->released.size());
+
+    for (u64 i = 0; i < n; i++)
+        out_buffers[i] = r->released[i];
+
+    r->released.erase(r->released.begin(), r->released.begin() + n);
+
+    *inout_count = n;
+    *out_released = r->last_released_ns;
+    return 0;
+}
+
+void audrecRecorderClose(AudrecRecorder* recorder)
+{
+    std::lock_guard<std::mutex> lk(g_audrec_lock);
+    mockIpc();
+
+    MockRecorder* r = recorder->impl;
+    g_recorders.erase(std::find(g_recorders.begin(), g_recorders.end(), r));
+    mockWaitableRelease(r->event);
+    delete r;
+
+    recorder->impl = NULL;
+}
+
+void mockAudrecReport()
+{
+    std::lock_guard<std::mutex> lk(g_audrec_lock);
+
+    printf("[audrec] recorder opens: %lu\n", (unsigned long)g_stat_opens);
+    printf("[audrec] buffers released: %lu\n", (unsigned long)g_stat_released);
+    printf("[audrec] frames dropped (no buffer queued): %lu\n", (unsigned long)g_stat_dropped_frames);
+    printf("[audrec] append calls: %lu, get-released calls: %lu\n",
+        (unsigned long)g_stat_append_calls, (unsigned long)g_stat_get_calls);
+}
@@ -0,0 +1,536 @@
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "mock.h"
+
+// btdrv stand-in. Simulated headsets connect and disconnect on request, and
+// every audio-out handle is a fake sink that records when buffers arrive
+// and how long each send blocked.
+//
+// An audio out becomes ready a while after it is opened, when its state
+// turns to started by itself; before that, its state event also fires on
+// the way there, with the state still stopped. Starting it before it is
+// ready is what gives some real headsets "super high gain", so the mock
+// counts it. With BTRED_HOST_AUDIO_READY_MS=0 it is ready right away, and
+// no event fires.
+//
+// A headset that is switched off drops its link, and ignores connection
+// requests until it is switched back on. Like most headsets, it then waits
+// to be paged by the console rather than connecting by itself.
+//
+// With BTRED_HOST_SINK_PPM set, a headset also plays from a buffer on its own
+// clock: a send blocks until what's queued ahead of it is down to the latency
+// the audio out was started with, and the buffer running dry is an underrun. Without
+// it, sends only cost BTRED_HOST_SEND_COST_NS and friends.
+
+struct MockHeadset {
+    BtdrvAddress addr;
+    bool connected;
+    bool powered;
+};
+
+struct MockAudioOut {
+    u32  index;
+    u32  headset;
+    bool ready;
+    bool started;
+    bool started_early;
+    u32  refused_rates;
+    BtdrvPcmParameter param;
+    MockWaitable* event;
+
+    u64  sends;
+    u64  bytes;
+    u64  failed;
+    u64  last_send_ns;
+    u64  first_send_ns;
+    MockStats interval;
+    MockStats cost;
+
+    // Headset clock, see above.
+    u64  buffer_frames;
+    u64  play_start_ns;         // 0 = nothing queued yet
+    u64  play_start_frames;     // frames sent when playback (re)started
+    u64  sent_frames;
+    u64  sink_underruns;
+};
+
+static std::mutex g_btdrv_lock;
+static std::vector<MockHeadset> g_headsets;
+static std::vector<MockWaitable*> g_connection_events;
+static std::map<u32, MockAudioOut*> g_audio_outs;
+static std::vector<MockAudioOut*> g_closed_audio_outs;
+static u32  g_next_handle = 0x100;
+static u32  g_next_index;
+static bool g_is_initialized;
+
+static u64 g_stat_connects;
+static u64 g_stat_disconnects;
+static u64 g_stat_open_connection_calls;
+
+// Console wake-up, until the first send after it.
+static u64 g_wake_ns;
+static MockStats g_stat_wake_to_send;
+
+static int FindHeadset(BtdrvAddress addr)
+{
+    for (size_t i = 0; i < g_headsets.size(); i++) {
+        if (memcmp(&g_headsets[i].addr, &addr, sizeof(addr)) == 0)
+            return (int)i;
+    }
+
+    return -1;
+}
+
+static void SignalConnectionEvents()
+{
+    for (MockWaitable* e : g_connection_events)
+        mockWaitableSignal(e);
+}
+
+static void SetConnected(int idx, bool connected)
+{
+    if (g_headsets[idx].connected == connected)
+        return;
+
+    g_headsets[idx].connected = connected;
+
+    if (connected) {
+        g_stat_connects++;
+    }
+    else {
+        g_stat_disconnects++;
+
+        // Audio outs of a dropped link stop delivering.
+        for (auto& it : g_audio_outs) {
+            if (it.second->headset == (u32)idx && it.second->started) {
+                it.second->started = false;
+                mockWaitableSignal(it.second->event);
+            }
+        }
+    }
+
+    SignalConnectionEvents();
+}
+
+static void SetConnectedLater(int idx, bool connected, u64 delay_ns)
+{
+    std::thread([idx, connected, delay_ns]() {
+        svcSleepThread(delay_ns);
+        std::lock_guard<std::mutex> lk(g_btdrv_lock);
+
+        if (!connected || g_headsets[idx].powered)
+            SetConnected(idx, connected);
+    }).detach();
+}
+
+void mockBtdrvSetPowered(u32 headset, bool powered)
+{
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+
+    if (headset >= g_headsets.size())
+        return;
+
+    g_headsets[headset].powered = powered;
+
+    if (!powered)
+        SetConnected(headset, false);
+}
+
+void mockBtdrvNoteWake()
+{
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+    g_wake_ns = mockNow();
+}
+
+void mockBtdrvSetAllConnected(bool connected, u64 delay_ns)
+{
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+
+    for (size_t i = 0; i < g_headsets.size(); i++)
+        SetConnectedLater((int)i, connected, delay_ns);
+}
+
+Result btdrvInitialize(void)
+{
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+    Result rc = mockServiceInit();
+
+    if (R_FAILED(rc))
+        return rc;
+
+    if (!g_is_initialized) {
+        const MockWorldConfig& cfg = mockConfig();
+
+        for (u32 i = 0; i < cfg.num_headsets; i++) {
+            MockHeadset h = {};
+            h.addr = BtdrvAddress{{0x00, 0x11, 0x22, 0x33, 0x44, (u8)(0x55 + i)}};
+            h.connected = false;
+            h.powered = true;
+            g_headsets.push_back(h);
+            SetConnectedLater((int)i, true, cfg.connect_delay_ns + i * cfg.connect_step_ns);
+        }
+
+        g_is_initialized = true;
+        mockWorldStart();
+    }
+
+    return 0;
+}
+
+void btdrvExit(void)
+{
+}
+
+Result btdrvAcquireAudioConnectionStateChangedEvent(Event* out_event, bool autoclear)
+{
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+    mockIpc();
+    out_event->obj = mockWaitableCreate();
+    out_event->autoclear = autoclear;
+    mockWaitableRetain(out_event->obj);
+    g_connection_events.push_back(out_event->obj);
+    return 0;
+}
+
+Result btdrvAcquireAudioEvent(Event* out_event, bool autoclear)
+{
+    mockIpc();
+    return eventCreate(out_event, autoclear);
+}
+
+Result btdrvGetConnectedAudioDevice(BtdrvAddress* addrs, s32 count, s32* total_out)
+{
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+    mockIpc();
+
+    s32 n = 0;
+    for (const MockHeadset& h : g_headsets) {
+        if (h.connected && n < count)
+            addrs[n++] = h.addr;
+    }
+
+    *total_out = n;
+    return 0;
+}
+
+Result btdrvOpenAudioConnection(BtdrvAddress addr)
+{
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+    mockIpc();
+    g_stat_open_connection_calls++;
+
+    int idx = FindHeadset(addr);
+
+    if (idx < 0)
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    if (!g_headsets[idx].connected && g_headsets[idx].powered)
+        SetConnectedLater(idx, true, mockConfig().connect_delay_ns);
+
+    return 0;
+}
+
+Result btdrvCloseAudioConnection(BtdrvAddress addr)
+{
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+    mockIpc();
+
+    int idx = FindHeadset(addr);
+
+    if (idx < 0)
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    SetConnected(idx, false);
+    return 0;
+}
+
+Result btdrvGetPairedDeviceInfo(BtdrvAddress addr, SetSysBluetoothDevicesSettings* settings)
+{
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+    mockIpc();
+
+    int idx = FindHeadset(addr);
+
+    if (idx < 0)
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    memset(settings, 0, sizeof(*settings));
+    settings->addr = addr;
+    snprintf(settings->name, sizeof(settings->name), "Mock Headset %d", idx);
+    return 0;
+}
+
+Result btdrvAddPairedDeviceInfo(const SetSysBluetoothDevicesSettings* settings)
+{
+    mockIpc();
+    return 0;
+}
+
+Result btdrvOpenAudioOut(BtdrvAddress addr, u32* audio_handle)
+{
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+    mockIpc();
+
+    int idx = FindHeadset(addr);
+
+    if (idx < 0 || !g_headsets[idx].connected)
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    MockAudioOut* out = new MockAudioOut{};
+    out->index = g_next_index++;
+    out->headset = idx;
+    out->event = mockWaitableCreate();
+
+    u32 handle = g_next_handle++;
+    g_audio_outs[handle] = out;
+    *audio_handle = handle;
+
+    u64 ready_ns = mockConfig().audio_ready_ns;
+
+    if (ready_ns == 0) {
+        out->ready = true;
+        return 0;
+    }
+
+    std::thread([handle, ready_ns]() {
+        // A transitional change first, then ready.
+        for (int step = 0; step < 2; step++) {
+            svcSleepThread(ready_ns / 2);
+            std::lock_guard<std::mutex> lk(g_btdrv_lock);
+
+            auto it = g_audio_outs.find(handle);
+
+            if (it == g_audio_outs.end())
+                return;
+
+            it->second->ready = step == 1;
+            mockWaitableSignal(it->second->event);
+        }
+    }).detach();
+
+    return 0;
+}
+
+Result btdrvCloseAudioOut(u32 audio_handle)
+{
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+    mockIpc();
+
+    auto it = g_audio_outs.find(audio_handle);
+
+    if (it == g_audio_outs.end())
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    mockWaitableRelease(it->second->event);
+    it->second->event = NULL;
+    g_closed_audio_outs.push_back(it->second);
+    g_audio_outs.erase(it);
+    return 0;
+}
+
+Result btdrvAcquireAudioOutStateChangedEvent(u32 audio_handle, Event* out_event, bool autoclear)
+{
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+    mockIpc();
+
+    auto it = g_audio_outs.find(audio_handle);
+
+    if (it == g_audio_outs.end())
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    mockWaitableRetain(it->second->event);
+    out_event->obj = it->second->event;
+    out_event->autoclear = autoclear;
+    return 0;
+}
+
+Result btdrvGetAudioOutState(u32 audio_handle, BtdrvAudioOutState* out)
+{
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+    mockIpc();
+
+    auto it = g_audio_outs.find(audio_handle);
+
+    if (it == g_audio_outs.end())
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    *out = it->second->ready || it->second->started ? BtdrvAudioOutState_Started : BtdrvAudioOutState_Stopped;
+    return 0;
+}
+
+Result btdrvStartAudioOut(u32 audio_handle, const BtdrvPcmParameter* pcm_param, s64 in_latency, s64* out_latency, u64* out1)
+{
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+    mockIpc();
+
+    auto it = g_audio_outs.find(audio_handle);
+
+    if (it == g_audio_outs.end())
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    u32 sink_rate = mockConfig().sink_rate;
+
+    if (sink_rate != 0 && pcm_param->sample_rate != sink_rate) {
+        it->second->refused_rates++;
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    }
+
+    it->second->started = true;
+    it->second->started_early = !it->second->ready;
+    it->second->param = *pcm_param;
+    it->second->buffer_frames = in_latency * pcm_param->sample_rate / 1000000000LL;
+    it->second->play_start_ns = 0;
+    mockWaitableSignal(it->second->event);
+
+    *out_latency = in_latency;
+    *out1 = 0;
+    return 0;
+}
+
+Result btdrvStopAudioOut(u32 audio_handle)
+{
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+    mockIpc();
+
+    auto it = g_audio_outs.find(audio_handle);
+
+    if (it == g_audio_outs.end())
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    it->second->started = false;
+    mockWaitableSignal(it->second->event);
+    return 0;
+}
+
+// Queues frames on the headset at `now`, and returns how long the send has to
+// wait for them to fit in its buffer.
+static u64 SinkQueue(MockAudioOut* out, u64 now, u64 frames)
+{
+    double rate = out->param.sample_rate * (1.0 + mockConfig().sink_ppm / 1e6);
+    double played = out->play_start_frames + (now - out->play_start_ns) * rate / 1e9;
+
+    if (out->play_start_ns == 0 || played > out->sent_frames) {
+        if (out->play_start_ns != 0)
+            out->sink_underruns++;
+
+        out->play_start_ns = now;
+        out->play_start_frames = out->sent_frames;
+    }
+
+    // The send returns once what was queued before it is down to the
+    // latency.
+    s64 excess = (s64)(out->sent_frames - out->play_start_frames) - (s64)out->buffer_frames;
+    out->sent_frames += frames;
+
+    if (excess <= 0)
+        return 0;
+
+    u64 fits_ns = out->play_start_ns + (u64)(excess * 1e9 / rate);
+    return fits_ns > now ? fits_ns - now : 0;
+}
+
+Result btdrvSendAudioData(u32 audio_handle, const void* buffer, u64 size, u64* transferred_size)
+{
+    const MockWorldConfig& cfg = mockConfig();
+    u64 start = mockNow();
+
+    // The sink's cost is paid outside the lock so that sends on different
+    // handles overlap, as they would in the real driver.
+    u64 cost = cfg.send_cost_ns;
+
+    if (cfg.send_jitter_ns != 0)
+        cost += (u64)rand() % cfg.send_jitter_ns;
+
+    MockAudioOut* out;
+    {
+        std::lock_guard<std::mutex> lk(g_btdrv_lock);
+
+        auto it = g_audio_outs.find(audio_handle);
+
+        if (it == g_audio_outs.end())
+            return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+        out = it->second;
+
+        if (!out->started) {
+            out->failed++;
+            return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+        }
+
+        if (cfg.send_spike_every != 0 && out->sends % cfg.send_spike_every == cfg.send_spike_every - 1)
+            cost += cfg.send_spike_ns;
+
+        if (cfg.sink_clock)
+            cost = std::max(cost, SinkQueue(out, start, size / (2 * sizeof(s16))));
+    }
+
+    if (cost != 0)
+        mockSleepUntil(start + cost);
+
+    u64 end = mockNow();
+
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+
+    if (out->sends == 0)
+        out->first_send_ns = end;
+    else
+        out->interval.Add(end - out->last_send_ns);
+
+    if (g_wake_ns != 0) {
+        g_stat_wake_to_send.Add(end - g_wake_ns);
+        g_wake_ns = 0;
+    }
+
+    out->cost.Add(end - start);
+    out->last_send_ns = end;
+    out->sends++;
+    out->bytes += size;
+
+    *transferred_size = size;
+    return 0;
+}
+
+static void ReportAudioOut(const MockAudioOut* out)
+{
+    u64 frames = out->bytes / (2 * sizeof(s16));
+    double secs = (out->last_send_ns - out->first_send_ns) / 1e9;
+
+    printf("[btdrv] audio out #%u (headset %u): %u Hz, %lu sends, %lu frames, %.1f frames/s, %lu failed, %u rates refused%s\n",
+        out->index, out->headset, out->param.sample_rate, (unsigned long)out->sends, (unsigned long)frames,
+        secs > 0 ? frames / secs : 0.0, (unsigned long)out->failed, out->refused_rates,
+        out->started_early ? ", STARTED BEFORE READY" : "");
+
+    if (mockConfig().sink_clock)
+        printf("[btdrv]   headset clock %+.0f ppm, %lu underruns\n",
+            mockConfig().sink_ppm, (unsigned long)out->sink_underruns);
+
+    MockStats interval = out->interval;
+    MockStats cost = out->cost;
+    interval.Print("[btdrv]   send interval");
+    cost.Print("[btdrv]   send duration");
+}
+
+void mockBtdrvReport()
+{
+    std::lock_guard<std::mutex> lk(g_btdrv_lock);
+
+    printf("[btdrv] connects: %lu, disconnects: %lu, open-connection calls: %lu\n",
+        (unsigned long)g_stat_connects, (unsigned long)g_stat_disconnects,
+        (unsigned long)g_stat_open_connection_calls);
+
+    for (const MockAudioOut* out : g_closed_audio_outs)
+        ReportAudioOut(out);
+
+    for (auto& it : g_audio_outs)
+        ReportAudioOut(it.second);
+
+    if (!g_stat_wake_to_send.samples.empty()) {
+        MockStats wake = g_stat_wake_to_send;
+        wake.Print("[btdrv] wake to first send");
+    }
+}
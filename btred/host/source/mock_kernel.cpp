@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <atomic>
+#include "mock.h"
+
+// One lock and one condition variable guard every waitable object. This is
+// far from how the kernel does it, but it is simple and correct, and the
+// mock is never the bottleneck.
+static std::mutex g_lock;
+static std::condition_variable g_cv;
+
+static std::atomic<u64> g_stat_threads_started;
+
+struct MockWaitable {
+    bool signaled;
+    u32  refs;
+};
+
+extern "C" {
+char* fake_heap_start;
+char* fake_heap_end;
+}
+
+u64 mockNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void mockSleepUntil(u64 deadline_ns)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline_ns / 1000000000ULL;
+    ts.tv_nsec = deadline_ns % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0);
+}
+
+u64 armGetSystemTickFreq(void)
+{
+    return 19200000ULL;
+}
+
+u64 armNsToTicks(u64 ns)
+{
+    return (ns * 12) / 625;
+}
+
+u64 armTicksToNs(u64 tick)
+{
+    return (tick * 625) / 12;
+}
+
+u64 armGetSystemTick(void)
+{
+    return armNsToTicks(mockNow());
+}
+
+u64 svcGetSystemTick(void)
+{
+    return armGetSystemTick();
+}
+
+u64 randomGet64(void)
+{
+    static std::mutex lock;
+    static std::mt19937_64 rng(std::random_device{}());
+
+    std::lock_guard<std::mutex> lk(lock);
+    return rng();
+}
+
+void svcSleepThread(s64 nano)
+{
+    if (nano <= 0) {
+        sched_yield();
+        return;
+    }
+
+    mockSleepUntil(mockNow() + nano);
+}
+
+void svcExitProcess(void)
+{
+    fflush(stdout);
+    _exit(0);
+}
+
+void fatalThrow(Result err)
+{
+    fprintf(stderr, "[host] fatal 0x%x\n", err);
+    mockWorldReport();
+    _exit(1);
+}
+
+void fatalThrowWithContext(Result err, FatalPolicy type, FatalCpuContext* ctx)
+{
+    fprintf(stderr, "[host] fatal 0x%x (pc offset 0x%lx)\n", err,
+        (unsigned long)(ctx->aarch64_ctx.pc - ctx->aarch64_ctx.start_address));
+    mockWorldReport();
+    _exit(1);
+}
+
+//---------------------------------------------------------------------------
+// Waitables
+//---------------------------------------------------------------------------
+
+MockWaitable* mockWaitableCreate()
+{
+    MockWaitable* obj = new MockWaitable;
+    obj->signaled = false;
+    obj->refs = 1;
+    return obj;
+}
+
+void mockWaitableRetain(MockWaitable* obj)
+{
+    std::lock_guard<std::mutex> lk(g_lock);
+    obj->refs++;
+}
+
+void mockWaitableRelease(MockWaitable* obj)
+{
+    std::lock_guard<std::mutex> lk(g_lock);
+
+    if (--obj->refs == 0)
+        delete obj;
+}
+
+void mockWaitableSignal(MockWaitable* obj)
+{
+    std::lock_guard<std::mutex> lk(g_lock);
+    obj->signaled = true;
+    g_cv.notify_all();
+}
+
+Result eventCreate(Event* t, bool autoclear)
+{
+    t->obj = mockWaitableCreate();
+    t->autoclear = autoclear;
+    return 0;
+}
+
+Result eventWait(Event* t, u64 timeout)
+{
+    s32 idx;
+    Waiter w = waiterForEvent(t);
+    return waitObjects(&idx, &w, 1, timeout);
+}
+
+Result eventFire(Event* t)
+{
+    mockWaitableSignal(t->obj);
+    return 0;
+}
+
+Result eventClear(Event* t)
+{
+    std::lock_guard<std::mutex> lk(g_lock);
+    t->obj->signaled = false;
+    return 0;
+}
+
+void eventClose(Event* t)
+{
+    if (t->obj != NULL) {
+        mockWaitableRelease(t->obj);
+        t->obj = NULL;
+    }
+}
+
+void ueventCreate(UEvent* e, bool auto_clear)
+{
+    std::lock_guard<std::mutex> lk(g_lock);
+    e->signal = false;
+    e->auto_clear = auto_clear;
+}
+
+void ueventClear(UEvent* e)
+{
+    std::lock_guard<std::mutex> lk(g_lock);
+    e->signal = false;
+}
+
+void ueventSignal(UEvent* e)
+{
+    std::lock_guard<std::mutex> lk(g_lock);
+    e->signal = true;
+    g_cv.notify_all();
+}
+
+void utimerCreate(UTimer* t, u64 interval, TimerType type)
+{
+    std::lock_guard<std::mutex> lk(g_lock);
+    t->type = type;
+    t->started = false;
+    t->next_tick = 0;
+    t->interval = interval;
+}
+
+void utimerStart(UTimer* t)
+{
+    std::lock_guard<std::mutex> lk(g_lock);
+    t->started = true;
+    t->next_tick = mockNow() + t->interval;
+    g_cv.notify_all();
+}
+
+void utimerStop(UTimer* t)
+{
+    std::lock_guard<std::mutex> lk(g_lock);
+    t->started = false;
+    g_cv.notify_all();
+}
+
+Result waitObjects(s32* idx_out, const Waiter* objects, s32 num_objects, u64 timeout)
+{
+    std::unique_lock<std::mutex> lk(g_lock);
+
+    u64 deadline = (timeout == UINT64_MAX) ? UINT64_MAX : mockNow() + timeout;
+
+    while (true) {
+        u64 now = mockNow();
+        u64 wake = deadline;
+
+        for (s32 i = 0; i < num_objects; i++) {
+            switch (objects[i].type) {
+                case WaiterType_Event: {
+                    Event* e = (Event*) objects[i].obj;
+
+                    if (e->obj->signaled) {
+                        if (e->autoclear)
+                            e->obj->signaled = false;
+                        *idx_out = i;
+                        return 0;
+                    }
+                    break;
+                }
+
+                case WaiterType_UEvent: {
+                    UEvent* e = (UEvent*) objects[i].obj;
+
+                    if (e->signal) {
+                        if (e->auto_clear)
+                            e->signal = false;
+                        *idx_out = i;
+                        return 0;
+                    }
+                    break;
+                }
+
+                case WaiterType_UTimer: {
+                    UTimer* t = (UTimer*) objects[i].obj;
+
+                    if (!t->started)
+                        break;
+
+                    if (now >= t->next_tick) {
+                        if (t->type == TimerType_Repeating)
+                            t->next_tick += t->interval;
+                        else
+                            t->started = false;
+                        *idx_out = i;
+                        return 0;
+                    }
+
+                    if (t->next_tick < wake)
+                        wake = t->next_tick;
+                    break;
+                }
+            }
+        }
+
+        if (now >= deadline)
+            return KERNELRESULT(TimedOut);
+
+        if (wake == UINT64_MAX) {
+            g_cv.wait(lk);
+        }
+        else {
+            // CLOCK_MONOTONIC and steady_clock share an epoch on Linux.
+            g_cv.wait_until(lk, std::chrono::steady_clock::time_point(std::chrono::nanoseconds(wake)));
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+// Threads
+//---------------------------------------------------------------------------
+
+static void* ThreadEntry(void* arg)
+{
+    Thread* t = (Thread*) arg;
+    t->entry(t->arg);
+    return NULL;
+}
+
+Result threadCreate(Thread* t, ThreadFunc entry, void* arg, void* stack_mem, size_t stack_sz, int prio, int cpuid)
+{
+    // The caller's stack is not used: glibc wants more than the 16 KiB the
+    // sysmodule hands out, and sizing it is not what we are measuring.
+    t->entry = entry;
+    t->arg = arg;
+    t->stack_mem = stack_mem;
+    t->stack_sz = stack_sz;
+    t->prio = prio;
+    t->cpuid = cpuid;
+    t->started = false;
+    return 0;
+}
+
+Result threadStart(Thread* t)
+{
+    if (pthread_create(&t->pthread, NULL, ThreadEntry, t) != 0)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    g_stat_threads_started++;
+    t->started = true;
+    return 0;
+}
+
+Result threadWaitForExit(Thread* t)
+{
+    if (t->started) {
+        pthread_join(t->pthread, NULL);
+        t->started = false;
+    }
+
+    return 0;
+}
+
+Result threadClose(Thread* t)
+{
+    return 0;
+}
+
+void mockKernelReport()
+{
+    printf("[kernel] threads started: %lu\n", (unsigned long)g_stat_threads_started.load());
+}
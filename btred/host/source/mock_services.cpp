@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <mutex>
+#include "mock.h"
+
+// set:sys, audctl and psc:m stand-ins.
+
+static std::mutex g_services_lock;
+
+static u64   g_stat_setsys_volume_calls;
+static u64   g_stat_master_volume_calls;
+static float g_master_volume = 1.0f;
+
+static MockWaitable* g_psc_event;
+static PscPmState    g_psc_state = PscPmState_Awake;
+static u64 g_stat_psc_requests;
+
+Result setsysInitialize(void)
+{
+    return mockServiceInit();
+}
+
+void setsysExit(void)
+{
+}
+
+Result setsysGetAudioVolume(SetSysAudioDevice device, SetSysAudioVolume* out)
+{
+    const MockWorldConfig& cfg = mockConfig();
+
+    mockIpc();
+
+    {
+        std::lock_guard<std::mutex> lk(g_services_lock);
+        g_stat_setsys_volume_calls++;
+    }
+
+    u8 volume = cfg.volume;
+
+    // Sweep through the 16 levels so gain changes are exercised.
+    if (cfg.volume_step_ns != 0)
+        volume = (u8)((mockNow() / cfg.volume_step_ns) % 16);
+
+    out->unk_x0 = 0;
+    out->volume = volume;
+    return 0;
+}
+
+Result audctlInitialize(void)
+{
+    return mockServiceInit();
+}
+
+void audctlExit(void)
+{
+}
+
+Result audctlSetSystemOutputMasterVolume(float volume)
+{
+    std::lock_guard<std::mutex> lk(g_services_lock);
+    mockIpc();
+    g_master_volume = volume;
+    g_stat_master_volume_calls++;
+    return 0;
+}
+
+Result pscmInitialize(void)
+{
+    return mockServiceInit();
+}
+
+void pscmExit(void)
+{
+}
+
+Result pscmGetPmModule(PscPmModule* out, PscPmModuleId module_id, const u32* dependencies, u32 dependency_count, bool autoclear)
+{
+    std::lock_guard<std::mutex> lk(g_services_lock);
+    mockIpc();
+
+    if (g_psc_event == NULL)
+        g_psc_event = mockWaitableCreate();
+
+    mockWaitableRetain(g_psc_event);
+    out->event.obj = g_psc_event;
+    out->event.autoclear = autoclear;
+    out->module_id = module_id;
+    return 0;
+}
+
+Result pscPmModuleGetRequest(PscPmModule* module, PscPmState* out_state, u32* out_flags)
+{
+    std::lock_guard<std::mutex> lk(g_services_lock);
+    mockIpc();
+    *out_state = g_psc_state;
+    *out_flags = 0;
+    return 0;
+}
+
+Result pscPmModuleAcknowledge(PscPmModule* module, PscPmState state)
+{
+    mockIpc();
+    return 0;
+}
+
+Result pscPmModuleFinalize(PscPmModule* module)
+{
+    mockIpc();
+    return 0;
+}
+
+void pscPmModuleClose(PscPmModule* module)
+{
+    eventClose(&module->event);
+}
+
+void mockPscRequest(PscPmState state)
+{
+    std::lock_guard<std::mutex> lk(g_services_lock);
+    g_psc_state = state;
+    g_stat_psc_requests++;
+
+    if (g_psc_event != NULL)
+        mockWaitableSignal(g_psc_event);
+}
+
+void mockServicesReport()
+{
+    std::lock_guard<std::mutex> lk(g_services_lock);
+
+    printf("[setsys] get-volume calls: %lu\n", (unsigned long)g_stat_setsys_volume_calls);
+    printf("[audctl] master-volume calls: %lu, final master volume: %.1f\n",
+        (unsigned long)g_stat_master_volume_calls, g_master_volume);
+    printf("[psc] requests: %lu\n", (unsigned long)g_stat_psc_requests);
+}
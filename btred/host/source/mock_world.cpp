@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include "mock.h"
+
+static u64 EnvU64(const char* name, u64 def)
+{
+    const char* v = getenv(name);
+    return v != NULL ? strtoull(v, NULL, 0) : def;
+}
+
+static float EnvFloat(const char* name, float def)
+{
+    const char* v = getenv(name);
+    return v != NULL ? strtof(v, NULL) : def;
+}
+
+static MockWorldConfig LoadConfig()
+{
+    MockWorldConfig cfg;
+    cfg.duration_ns      = EnvU64("BTRED_HOST_DURATION_MS", 20000) * 1000000ULL;
+    cfg.num_headsets     = (u32)EnvU64("BTRED_HOST_HEADSETS", 1);
+    cfg.connect_delay_ns = EnvU64("BTRED_HOST_CONNECT_DELAY_MS", 200) * 1000000ULL;
+    cfg.connect_step_ns  = EnvU64("BTRED_HOST_CONNECT_STEP_MS", 0) * 1000000ULL;
+    cfg.render_period_ns = EnvU64("BTRED_HOST_RENDER_PERIOD_US", 5000) * 1000ULL;
+    cfg.send_cost_ns     = EnvU64("BTRED_HOST_SEND_COST_US", 150) * 1000ULL;
+    cfg.send_jitter_ns   = EnvU64("BTRED_HOST_SEND_JITTER_US", 100) * 1000ULL;
+    cfg.send_spike_ns    = EnvU64("BTRED_HOST_SEND_SPIKE_MS", 0) * 1000000ULL;
+    cfg.send_spike_every = (u32)EnvU64("BTRED_HOST_SEND_SPIKE_EVERY", 0);
+    cfg.ipc_cost_ns      = EnvU64("BTRED_HOST_IPC_COST_US", 20) * 1000ULL;
+    cfg.volume           = (u8)EnvU64("BTRED_HOST_VOLUME", 10);
+    cfg.volume_step_ns   = EnvU64("BTRED_HOST_VOLUME_STEP_MS", 0) * 1000000ULL;
+    cfg.tone_hz          = EnvFloat("BTRED_HOST_TONE_HZ", 440.0f);
+    cfg.tone_amp         = EnvFloat("BTRED_HOST_TONE_AMP", 0.5f);
+    cfg.silence_every_ns = EnvU64("BTRED_HOST_SILENCE_EVERY_MS", 0) * 1000000ULL;
+    cfg.silence_for_ns   = EnvU64("BTRED_HOST_SILENCE_FOR_MS", 5000) * 1000000ULL;
+    cfg.sleep_at_ns      = EnvU64("BTRED_HOST_SLEEP_AT_MS", 0) * 1000000ULL;
+    cfg.sleep_for_ns     = EnvU64("BTRED_HOST_SLEEP_FOR_MS", 3000) * 1000000ULL;
+    cfg.stall_every_ns   = EnvU64("BTRED_HOST_STALL_EVERY_MS", 0) * 1000000ULL;
+    cfg.stall_for_ns     = EnvU64("BTRED_HOST_STALL_FOR_MS", 100) * 1000000ULL;
+    cfg.power_off_at_ns  = EnvU64("BTRED_HOST_POWER_OFF_AT_MS", 0) * 1000000ULL;
+    cfg.power_off_for_ns = EnvU64("BTRED_HOST_POWER_OFF_FOR_MS", 5000) * 1000000ULL;
+    cfg.boot_delay_ns    = EnvU64("BTRED_HOST_BOOT_DELAY_MS", 0) * 1000000ULL;
+    cfg.audio_ready_ns   = EnvU64("BTRED_HOST_AUDIO_READY_MS", 300) * 1000000ULL;
+    cfg.sink_rate        = (u32)EnvU64("BTRED_HOST_SINK_RATE", 0);
+    cfg.sink_clock       = getenv("BTRED_HOST_SINK_PPM") != NULL;
+    cfg.sink_ppm         = EnvFloat("BTRED_HOST_SINK_PPM", 0.0f);
+
+    if (cfg.render_period_ns < 1000000ULL)
+        cfg.render_period_ns = 1000000ULL;
+
+    if (cfg.silence_for_ns > cfg.silence_every_ns)
+        cfg.silence_for_ns = cfg.silence_every_ns;
+
+    return cfg;
+}
+
+const MockWorldConfig& mockConfig()
+{
+    static MockWorldConfig cfg = LoadConfig();
+    return cfg;
+}
+
+void mockIpc()
+{
+    u64 cost = mockConfig().ipc_cost_ns;
+
+    if (cost != 0)
+        mockSleepUntil(mockNow() + cost);
+}
+
+static u64 g_boot_ns = mockNow();
+
+Result mockServiceInit()
+{
+    mockIpc();
+
+    if (mockNow() < g_boot_ns + mockConfig().boot_delay_ns)
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    return 0;
+}
+
+void mockGeneratePcm(u64 first_frame, s16* out, size_t frames)
+{
+    const MockWorldConfig& cfg = mockConfig();
+    const double w = 2.0 * M_PI * cfg.tone_hz / 48000.0;
+    const double a = 32767.0 * cfg.tone_amp;
+
+    // Right channel runs a fifth above the left so that channel mixups are
+    // visible in captured output.
+    for (size_t i = 0; i < frames; i++) {
+        double t = (double)(first_frame + i);
+
+        // The game going quiet: the end of each silence_every_ns.
+        if (cfg.silence_every_ns != 0) {
+            u64 t_ns = (first_frame + i) * 1000000000ULL / 48000;
+
+            if (t_ns % cfg.silence_every_ns >= cfg.silence_every_ns - cfg.silence_for_ns) {
+                out[2*i + 0] = 0;
+                out[2*i + 1] = 0;
+                continue;
+            }
+        }
+
+        out[2*i + 0] = (s16)lrint(a * sin(w * t));
+        out[2*i + 1] = (s16)lrint(a * sin(1.5 * w * t));
+    }
+}
+
+void MockStats::Print(const char* label)
+{
+    if (samples.empty()) {
+        printf("%s: no samples\n", label);
+        return;
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    size_t n = samples.size();
+    printf("%s: n=%lu p50=%.1fus p99=%.1fus max=%.1fus\n", label, (unsigned long)n,
+        samples[n / 2] / 1e3, samples[(n * 99) / 100] / 1e3, samples[n - 1] / 1e3);
+}
+
+static u64 g_world_start_ns;
+
+void mockWorldReport()
+{
+    static std::mutex report_lock;
+    std::lock_guard<std::mutex> lk(report_lock);
+
+    printf("[host] ran for %.2f s\n", (mockNow() - g_world_start_ns) / 1e9);
+    mockAudrecReport();
+    mockBtdrvReport();
+    mockServicesReport();
+    mockKernelReport();
+    fflush(stdout);
+}
+
+static void WorldThread()
+{
+    const MockWorldConfig& cfg = mockConfig();
+
+    if (cfg.sleep_at_ns != 0) {
+        mockSleepUntil(g_world_start_ns + cfg.sleep_at_ns);
+        printf("[host] console going to sleep\n");
+        mockPscRequest(PscPmState_ReadySleep);
+        mockBtdrvSetAllConnected(false, 0);
+
+        mockSleepUntil(g_world_start_ns + cfg.sleep_at_ns + cfg.sleep_for_ns);
+        printf("[host] console waking up\n");
+        mockBtdrvNoteWake();
+        mockPscRequest(PscPmState_Awake);
+        mockBtdrvSetAllConnected(true, cfg.connect_delay_ns);
+    }
+
+    if (cfg.duration_ns != 0) {
+        mockSleepUntil(g_world_start_ns + cfg.duration_ns);
+        mockWorldReport();
+        _exit(0);
+    }
+}
+
+static void PowerThread()
+{
+    const MockWorldConfig& cfg = mockConfig();
+
+    mockSleepUntil(g_world_start_ns + cfg.power_off_at_ns);
+    printf("[host] headset 0 switched off\n");
+    mockBtdrvSetPowered(0, false);
+
+    mockSleepUntil(g_world_start_ns + cfg.power_off_at_ns + cfg.power_off_for_ns);
+    printf("[host] headset 0 switched on\n");
+    mockBtdrvSetPowered(0, true);
+}
+
+void mockWorldStart()
+{
+    g_world_start_ns = mockNow();
+    std::thread(WorldThread).detach();
+
+    if (mockConfig().power_off_at_ns != 0)
+        std::thread(PowerThread).detach();
+}
@@ -1,11 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <malloc.h>
 #include <switch.h>
-#include <arm_neon.h>
-#include <math.h>
 #include "bt_audio_manager.h"
+#include "bt_capture.h"
 #include "bt_config.h"
+#include "bt_driver_lock.h"
+#include "bt_telemetry.h"
 
 //#define ENABLE_TRACE
 
@@ -18,50 +18,102 @@
 void NORETURN fatalThrowWithPc(Result err);
 
 
-BtAudioDevice::BtAudioDevice(BtdrvAddress addr):
+BtAudioDevice::BtAudioDevice(BtdrvAddress addr, const BtDeviceResources& resources):
     m_addr(addr),
+    m_resources(resources),
+    m_tuning(g_config.GetAudioTuning(addr)),
+    m_format(AUDIO_FORMAT_CAPTURE),
+    m_period(m_format.ToFrames(AudioSamples{m_tuning.period_samples})),
+    m_period_samples(m_format.ToSamples(m_period)),
+    m_period_bytes(m_format.ToBytes(m_period)),
+    m_period_ns(m_format.ToNs(m_period)),
+    m_out_format(m_format),
+    m_is_resampling(false),
+    m_channels(DspRouting::Stereo),
+    m_is_drift_corrected(false),
+    m_is_prebuffering(false),
+    m_prebuffer_periods(0),
     m_is_btdrv_initialized(false),
-    m_is_audrec_initialized(false),
     m_are_buffers_initialized(false),
-    m_is_thread_initialized(false)
+    m_is_thread_initialized(false),
+    m_is_capture_attached(false),
+    m_telemetry(),
+    m_open_ns(0),
+    m_opened_ns(0),
+    m_state(BtDeviceState::Connecting)
 {
+    m_capture_sink.ring = &m_ring;
+    m_capture_sink.signal = &m_ring_signal;
+    m_capture_sink.telemetry = &m_telemetry;
+    m_telemetry.addr = addr;
+
+    u64 start = armTicksToNs(svcGetSystemTick());
     g_config.SetHeadphonesBtAddress(addr);
+    u64 end = armTicksToNs(svcGetSystemTick());
+    g_telemetry.System().connect_config.Record((end - start) / 1000);
 }
 
-Result BtAudioDevice::Initialize()
+Result BtAudioDevice::Open()
 {
-    Result rc;
-
-    rc = InitializeBtdrv();
+    Result rc = InitializeBtdrv();
 
     if (R_FAILED(rc)) {
+        m_state.store(BtDeviceState::Stopped);
         return rc;
     }
 
-    rc = InitializeAudrec();
+    TRACE("[?] device connecting\n");
+    return rc;
+}
+
+Result BtAudioDevice::Start()
+{
+    Result rc;
+
+    m_state.store(BtDeviceState::Starting);
+    TRACE("[?] device starting\n");
+
+    // Whatever fails here, the audio out is closed by the destructor.
+    rc = StartBtdrv();
 
     if (R_FAILED(rc)) {
-        FinalizeBtdrv();
+        m_state.store(BtDeviceState::Stopped);
         return rc;
     }
 
     rc = InitializeBuffers();
 
     if (R_FAILED(rc)) {
-        FinalizeAudrec();
-        FinalizeBtdrv();
+        m_state.store(BtDeviceState::Stopped);
         return -1;
     }
 
+    g_telemetry.Register(&m_telemetry);
+
     rc = InitializeThread();
 
     if (R_FAILED(rc)) {
+        g_telemetry.Unregister(&m_telemetry);
         FinalizeBuffers();
-        FinalizeAudrec();
-        FinalizeBtdrv();
+        m_state.store(BtDeviceState::Stopped);
         return rc;
     }
 
+    // From here on, periods start arriving.
+    rc = g_capture.Attach(&m_capture_sink);
+
+    if (R_FAILED(rc)) {
+        FinalizeThread();
+        g_telemetry.Unregister(&m_telemetry);
+        FinalizeBuffers();
+        m_state.store(BtDeviceState::Stopped);
+        return rc;
+    }
+
+    m_is_capture_attached = true;
+    m_state.store(BtDeviceState::Streaming);
+    TRACE("[?] device streaming\n");
+
     return rc;
 }
 
@@ -69,11 +121,13 @@ Result BtAudioDevice::InitializeBtdrv()
 {
     Result rc;
 
-    mutexLock(&g_btdrv_mutex);
+    g_btdrv_control_lock.Lock();
+    u64 t0 = armTicksToNs(svcGetSystemTick());
+
     rc = btdrvOpenAudioOut(m_addr, &m_btdrv_handle);
 
     if (R_FAILED(rc)) {
-        mutexUnlock(&g_btdrv_mutex);
+        g_btdrv_control_lock.Unlock();
         return rc;
     }
 
@@ -81,7 +135,7 @@ Result BtAudioDevice::InitializeBtdrv()
 
     if (R_FAILED(rc)) {
         btdrvCloseAudioOut(m_btdrv_handle);
-        mutexUnlock(&g_btdrv_mutex);
+        g_btdrv_control_lock.Unlock();
         return rc;
     }
 
@@ -90,145 +144,165 @@ Result BtAudioDevice::InitializeBtdrv()
     if (R_FAILED(rc)) {
         eventClose(&m_btdrv_statechange_event);
         btdrvCloseAudioOut(m_btdrv_handle);
-        mutexUnlock(&g_btdrv_mutex);
+        g_btdrv_control_lock.Unlock();
         return rc;
     }
 
-    // Workaround: If I initialize AudioOut too early, for some reason
-    // it gets super high gain. This sleep seemingly prevently that.
-    // TODO: Investigate deeper.
-    svcSleepThread(2000000000ULL);
-
-    BtdrvPcmParameter param;
-    param.unk_x0 = 2;
-    param.sample_rate = 48000;
-    param.bits_per_sample = 16;
-
-    s64 latency = 4000000LL;
-    u64 out1;
-
-    rc = btdrvStartAudioOut(m_btdrv_handle, &param, latency, &latency, &out1);
-
-    // TODO: Maybe not necessary
-    #define BtdrvErrorAlreadyStarted 0x190071
-    //if (rc == BtdrvErrorAlreadyStarted)
-    //    rc = 0;
+    m_is_btdrv_initialized = true;
+    g_btdrv_control_lock.Unlock();
 
-    if (R_FAILED(rc)) {
-        eventClose(&m_btdrv_statechange_event);
-        btdrvCloseAudioOut(m_btdrv_handle);
-        mutexUnlock(&g_btdrv_mutex);
-        return rc;
-    }
+    m_opened_ns = armTicksToNs(svcGetSystemTick());
+    m_telemetry.open_ms = (m_opened_ns - t0) / 1000000;
+    m_open_ns = t0;
 
-    m_is_btdrv_initialized = true;
-    mutexUnlock(&g_btdrv_mutex);
     return rc;
 }
 
-void BtAudioDevice::FinalizeBtdrv()
+bool BtAudioDevice::IsReady()
 {
-    if (m_is_btdrv_initialized) {
-        mutexLock(&g_btdrv_mutex);
-        btdrvStopAudioOut(m_btdrv_handle);
-        eventClose(&m_btdrv_statechange_event);
-        btdrvCloseAudioOut(m_btdrv_handle);
-        mutexUnlock(&g_btdrv_mutex);
-        m_is_btdrv_initialized = false;
-    }
+    g_btdrv_control_lock.Lock();
+    Result rc = btdrvGetAudioOutState(m_btdrv_handle, &m_btdrv_state);
+    g_btdrv_control_lock.Unlock();
 
-    mutexLock(&g_btdrv_mutex);
-    btdrvCloseAudioConnection(m_addr);
-    mutexUnlock(&g_btdrv_mutex);
+    return R_SUCCEEDED(rc) && m_btdrv_state == BTDRV_READY_STATE;
 }
 
-Result BtAudioDevice::InitializeAudrec()
+Result BtAudioDevice::StartBtdrv()
 {
     Result rc;
 
-    rc = audrecInitialize();
+    // If AudioOut is started too early, for some reason it gets super high
+    // gain. The worker holds off Start() until IsReady(), or until
+    // GetReadyDeadline().
+    u64 t1 = armTicksToNs(svcGetSystemTick());
+    m_telemetry.ready_ms = (t1 - m_opened_ns) / 1000000;
 
-    if (R_FAILED(rc)) {
-        return rc;
-    }
+    // Offer the tuned rate first, if the pool has a filter for it, and fall
+    // back to the capture rate, which every headset takes.
+    u32 rates[2];
+    size_t num_rates = 0;
 
-    FinalOutputRecorderParameter param_in;
-    param_in.sample_rate = 48000;
-    param_in.channel_count = 2;
+    if (m_resources.resample_filter != NULL)
+        rates[num_rates++] = m_tuning.sample_rate;
 
-    FinalOutputRecorderParameterInternal param_out;
-    rc = audrecOpenFinalOutputRecorder(&m_audrec_recorder, &param_in, 0, &param_out);
+    rates[num_rates++] = m_format.sample_rate;
 
-    if (R_FAILED(rc)) {
-        audrecExit();
-        return rc;
-    }
+    g_btdrv_control_lock.Lock();
 
-    if (param_out.sample_rate != 48000) {
-        audrecExit();
-        return -1;
-    }
+    BtdrvPcmParameter param;
+    param.unk_x0 = 2;
+    param.bits_per_sample = m_format.bytes_per_sample * 8;
 
-    if (param_out.channel_count != 2) {
-        audrecExit();
-        return -1;
-    }
+    s64 latency;
+    u64 out1;
 
-    if (param_out.sample_format != 2) { //PcmInt16
-        audrecExit();
-        return -1;
-    }
+    for (size_t i = 0; i < num_rates; i++) {
+        param.sample_rate = rates[i];
+        latency = m_tuning.btdrv_latency_ms * 1000000LL;
 
-    TRACE("sample_rate: %u\n", param_out.sample_rate);
-    TRACE("channel_count: %u\n", param_out.channel_count);
-    TRACE("sample_format: %u\n", param_out.sample_format);
-    TRACE("state: %u\n", param_out.state);
+        rc = btdrvStartAudioOut(m_btdrv_handle, &param, latency, &latency, &out1);
 
-    rc = audrecRecorderStart(&m_audrec_recorder);
+        if (R_SUCCEEDED(rc))
+            break;
 
-    if (R_FAILED(rc)) {
-        audrecRecorderClose(&m_audrec_recorder);
-        audrecExit();
-        return rc;
+        TRACE("[?] audio out refused %u Hz: 0x%x\n", rates[i], rc);
     }
 
-    rc = audrecRecorderRegisterBufferEvent(&m_audrec_recorder, &m_audrec_buffer_event);
+    // TODO: Maybe not necessary
+    #define BtdrvErrorAlreadyStarted 0x190071
+    //if (rc == BtdrvErrorAlreadyStarted)
+    //    rc = 0;
 
     if (R_FAILED(rc)) {
-        audrecRecorderStop(&m_audrec_recorder);
-        audrecRecorderClose(&m_audrec_recorder);
-        audrecExit();
+        g_btdrv_control_lock.Unlock();
         return rc;
     }
 
-    m_is_audrec_initialized = true;
+    // The driver may not grant the latency we asked for.
+    m_tuning.btdrv_latency_ms = latency / 1000000LL;
+
+    g_btdrv_control_lock.Unlock();
+
+    m_out_format.sample_rate = param.sample_rate;
+    m_telemetry.sample_rate = param.sample_rate;
+
+    u64 t2 = armTicksToNs(svcGetSystemTick());
+    m_telemetry.start_ms = (t2 - t1) / 1000000;
 
     return rc;
 }
 
-void BtAudioDevice::FinalizeAudrec()
+void BtAudioDevice::FinalizeBtdrv()
 {
-    if (m_is_audrec_initialized) {
-        eventClose(&m_audrec_buffer_event);
-        audrecRecorderStop(&m_audrec_recorder);
-        audrecRecorderClose(&m_audrec_recorder);
-        audrecExit();
-        m_is_audrec_initialized = false;
+    // The send thread is gone by now, so nothing else uses the handle.
+    if (m_is_btdrv_initialized) {
+        g_btdrv_control_lock.Lock();
+        btdrvStopAudioOut(m_btdrv_handle);
+        eventClose(&m_btdrv_statechange_event);
+        btdrvCloseAudioOut(m_btdrv_handle);
+        g_btdrv_control_lock.Unlock();
+        m_is_btdrv_initialized = false;
     }
+
+    g_btdrv_control_lock.Lock();
+    btdrvCloseAudioConnection(m_addr);
+    g_btdrv_control_lock.Unlock();
 }
 
 Result BtAudioDevice::InitializeBuffers()
 {
-    m_buffer_mem = memalign(0x1000, TOTAL_SIZE);
+    // Slots are sized for the deepest ring any headset asks for.
+    size_t ring_periods = BtCapture::RingPeriods(m_tuning, m_format);
+    ring_periods = ring_periods < m_resources.ring_periods ? ring_periods : m_resources.ring_periods;
+
+    m_ring.Initialize(m_resources.ring_slots, ring_periods);
+
+    // A headset started at the capture rate is still resampled, by a hair,
+    // if its drift is corrected.
+    const DspResampleFilter* filter = m_out_format != m_format ?
+        m_resources.resample_filter : m_resources.drift_filter;
+
+    m_is_resampling = filter != NULL;
+    m_is_drift_corrected = m_is_resampling && m_tuning.drift_ppm != 0;
+    m_is_prebuffering = m_is_drift_corrected;
+    m_prebuffer_periods = ring_periods < 2 ? ring_periods : 2;
+    u64 resample_ns = 0;
+
+    // The curve is fixed for the connection, so is the filter.
+    // Bands DspEqInit drops don't count.
+    BtDeviceTuning device_tuning = g_config.GetDeviceTuning(m_addr);
+    DspEqInit(&m_eq, device_tuning.bands, device_tuning.num_bands, m_format.sample_rate);
+    m_channels = device_tuning.channels;
+
+    if (m_eq.num_bands != 0 || m_channels != DspRouting::Stereo) {
+        TRACE("[?] channels %u, eq: %u bands\n", (u32)device_tuning.channels, m_eq.num_bands);
+    }
 
-    if (m_buffer_mem == NULL)
-        return -1;
+    if (m_is_resampling) {
+        m_resampler.Initialize(filter, m_period,
+            m_format.sample_rate, m_out_format.sample_rate, m_resources.resample_mem);
+        resample_ns = m_format.ToNs(m_resampler.GetDelay());
+    }
 
-    size_t i;
-    for (i=0; i<NUM_BUF; i++) {
-        m_buffers[i] = (void*)((u16*)m_buffer_mem + i*SAMPLES_PER_BUF);
+    if (m_is_drift_corrected) {
+        m_drift.Initialize(m_tuning.drift_ppm, m_period_ns);
+        resample_ns += m_period_ns * (m_prebuffer_periods - 1);
     }
 
+    // End-to-end buffering: one period to fill a capture buffer, the
+    // limiter's look-ahead (there for the safety detector even when not
+    // limiting), whatever has queued up in the ring (at least the prebuffer),
+    // the resampler's filter, and the driver's own latency.
+    u64 btdrv_ns = m_tuning.btdrv_latency_ms * 1000000ULL;
+    u64 limiter_ns = m_format.ToNs(AudioFrames{DSP_LIMITER_DELAY_FRAMES});
+    m_telemetry.min_buffering_ns = m_period_ns + limiter_ns + resample_ns + btdrv_ns;
+    m_telemetry.max_buffering_ns = m_period_ns * (1 + ring_periods) + limiter_ns + resample_ns + btdrv_ns;
+
+    TRACE("[?] buffering: %lu..%lu ms (%u x %u samples, ring %lu periods, btdrv %u ms, %u Hz)\n",
+        m_telemetry.min_buffering_ns / 1000000, m_telemetry.max_buffering_ns / 1000000,
+        m_tuning.num_buffers, m_tuning.period_samples, ring_periods, m_tuning.btdrv_latency_ms,
+        m_out_format.sample_rate);
+
     m_are_buffers_initialized = true;
     return 0;
 }
@@ -236,47 +310,42 @@ Result BtAudioDevice::InitializeBuffers()
 void BtAudioDevice::FinalizeBuffers()
 {
     if (m_are_buffers_initialized) {
-        free(m_buffer_mem);
+        m_ring.Finalize();
         m_are_buffers_initialized = false;
     }
 }
 
 Result BtAudioDevice::InitializeThread()
 {
-    #define DefaultStackSize 0x4000
-    #define DefaultPrio 0x2C
-    #define DefaultCore -2
-    Result rc;
+    // Below g_capture's thread, on the same core; btred.json only grants us
+    // core 3.
+    #define SendPrio 0x2C
+    #define SendCore 3
+    Result rc = 0;
 
-    m_workthread_stack = memalign(0x1000, DefaultStackSize);
+    // The slot's thread outlives the device; it is only created the first
+    // time the slot is used, and parked in between devices.
+    BtParkedThread* thread = m_resources.send_thread;
 
-    if (m_workthread_stack == NULL) {
-        return -1;
-    }
+    if (!thread->IsInitialized()) {
+        rc = thread->Initialize(m_resources.send_stack, SEND_STACK_SIZE, SendPrio, SendCore);
 
-    rc = threadCreate(
-        &m_workthread,
-        (ThreadFunc) WorkerThreadTrampoline,
-        (void*) this,
-        m_workthread_stack,
-        DefaultStackSize,
-        DefaultPrio,
-        DefaultCore);
-
-    if (R_FAILED(rc)) {
-        free(m_workthread_stack);
-        return rc;
+        if (R_FAILED(rc)) {
+            return rc;
+        }
     }
 
     ueventCreate(&m_workthread_exitsignal, false);
+    ueventCreate(&m_ring_signal, true);
+    m_last_send_ns = 0;
+    m_idle_after_ns = m_tuning.idle_after_ms * 1000000ULL;
+    m_is_idle = false;
+    m_silent_ns = 0;
+    m_period_cost_ns = 0;
+    m_idle_ns = 0;
+    m_idle_saved_ns = 0;
 
-    rc = threadStart(&m_workthread);
-
-    if (R_FAILED(rc)) {
-        threadClose(&m_workthread);
-        free(m_workthread_stack);
-        return rc;
-    }
+    thread->Run((ThreadFunc) SendThreadTrampoline, (void*) this);
 
     m_is_thread_initialized = true;
 
@@ -287,152 +356,197 @@ void BtAudioDevice::FinalizeThread()
 {
     if (m_is_thread_initialized) {
         ueventSignal(&m_workthread_exitsignal);
-        threadWaitForExit(&m_workthread);
-        threadClose(&m_workthread);
-        free(m_workthread_stack);
+        m_resources.send_thread->Join();
         m_is_thread_initialized = false;
     }
 }
 
 BtAudioDevice::~BtAudioDevice()
 {
+    m_state.store(BtDeviceState::Stopping);
+    TRACE("[?] device stopping\n");
+
     FinalizeThread();
+
+    if (m_is_capture_attached) {
+        g_capture.Detach(&m_capture_sink);
+        m_is_capture_attached = false;
+    }
+
+    g_telemetry.Unregister(&m_telemetry);
     FinalizeBuffers();
-    FinalizeAudrec();
     FinalizeBtdrv();
 }
 
-Result BtAudioDevice::RefreshAudrec()
+Result BtAudioDevice::SendAudio(const void* buf, AudioBytes size)
 {
+    u64 transferred = 0;
     Result rc;
 
-    FinalizeAudrec();
+    u64 start = armTicksToNs(svcGetSystemTick());
 
-    rc = InitializeAudrec();
+    rc = btdrvSendAudioData(m_btdrv_handle, buf, size.count, &transferred);
 
-    if (R_FAILED(rc))
-        return rc;
+    u64 end = armTicksToNs(svcGetSystemTick());
+    m_telemetry.send_duration.Record((end - start) / 1000);
 
-    size_t i;
-    for (i=0; i<NUM_BUF; i++) {
-        QueueBuffer(m_buffers[i]);
-    }
+    // A short transfer loses the tail of one period; that's a glitch to
+    // count, not a reason to take the whole system down.
+    if (R_FAILED(rc))
+        BtDeviceTelemetry::Bump(m_telemetry.send_failures);
+    else if (transferred != size.count)
+        BtDeviceTelemetry::Bump(m_telemetry.short_transfers);
 
     return rc;
 }
 
-Result BtAudioDevice::QueueBuffer(void* buf)
+void BtAudioDevice::DrainRing()
 {
-    FinalOutputRecorderBuffer param;
-    param.released_ns = 0;
-    param.next_buffer_ptr = 0;
-    param.sample_buffer_ptr = (u64)buf;
-    param.sample_buffer_capacity = BUF_SIZE;
-    param.data_size = BUF_SIZE;
-    param.data_offset = 0;
-
-    return audrecRecorderAppendFinalOutputRecorderBuffer(&m_audrec_recorder, (u64)buf, &param);
-}
-
-Result BtAudioDevice::AudioReceived()
-{
-    u64 buffers[NUM_BUF];
-    u64 count = NUM_BUF;
-    u64 released;
-    Result rc;
+    #define UNDERRUN_GAP_NS ((3*m_period_ns)/2)
 
-    rc = audrecRecorderGetReleasedFinalOutputRecorderBuffers(&m_audrec_recorder, buffers, &count, &released);
+    BtPcmPeriod* period;
+    u64 now = armTicksToNs(svcGetSystemTick());
 
-    if (R_FAILED(rc))
-        return rc;
+    // If we went more than one and a half periods without anything to send,
+    // the headset ran dry.
+    if (!m_is_prebuffering && !m_is_idle && m_last_send_ns != 0 && (now - m_last_send_ns) > UNDERRUN_GAP_NS) {
+        m_ring.CountUnderrun();
+        m_telemetry.underruns.store(m_ring.GetUnderruns(), std::memory_order_relaxed);
 
-    if (count != 1)
-        return RefreshAudrec();
+        // The queue is gone; build it up again.
+        m_is_prebuffering = m_is_drift_corrected;
+    }
 
-    size_t i;
-    for (i=0; i<count; i++) {
-        void* buf = (void*) buffers[i];
+    if (m_is_prebuffering) {
+        if (m_ring.GetFill() < m_prebuffer_periods)
+            return;
 
-        ApplyVolume(buf);
-        SendAudio(buf);
-        QueueBuffer(buf);
+        m_is_prebuffering = false;
     }
 
-    #define TWO_PERIODS ((2*1000000000ULL*SAMPLES_PER_BUF)/48000)
+    if (m_is_idle && DrainIdle(now))
+        return;
+
+    // Periods are shared with the other devices, so they are sent straight
+    // from the capture pool, and handed back once btdrv is done with them.
+    // Processed or converted ones are sent from our own buffers instead.
+    while ((period = m_ring.Front()) != NULL) {
+        u64 release_ns = period->release_ns;
+        bool is_silent = period->is_silent;
+        const s16* samples = period->samples;
+        u64 start_ns = armTicksToNs(svcGetSystemTick());
+
+        if (m_channels != DspRouting::Stereo) {
+            DspApplyRouting(m_resources.eq_mem, samples, m_period_samples.count, m_channels);
+            samples = m_resources.eq_mem;
+        }
 
-    // If audrec gets out of sync (when switching apps), we need to refresh it.
-    if ((armTicksToNs(svcGetSystemTick()) - released) > TWO_PERIODS) {
-        return RefreshAudrec();
-    }
+        if (m_eq.num_bands != 0) {
+            DspApplyEq(m_resources.eq_mem, samples, m_period_samples.count, &m_eq);
+            samples = m_resources.eq_mem;
+        }
 
-    return rc;
-}
+        if (m_is_resampling) {
+            const s16* out;
+            u64 start = armTicksToNs(svcGetSystemTick());
+            AudioFrames frames = m_resampler.Process(samples, m_period, &out);
+            u64 end = armTicksToNs(svcGetSystemTick());
+            m_telemetry.resample_duration.Record((end - start) / 1000);
 
-Result BtAudioDevice::SendAudio(void* buf)
-{
-    u64 transferred = 0;
-    Result rc;
+            SendAudio(out, m_out_format.ToBytes(frames));
+        }
+        else {
+            SendAudio(samples, m_period_bytes);
+        }
 
-    mutexLock(&g_btdrv_mutex);
-    rc = btdrvSendAudioData(m_btdrv_handle, buf, BUF_SIZE, &transferred);
-    mutexUnlock(&g_btdrv_mutex);
+        m_ring.Pop();
+        period->Release();
 
-    if (R_SUCCEEDED(rc)) {
-        if (transferred != BUF_SIZE)
-            fatalThrow(0x8833);
-    }
+        now = armTicksToNs(svcGetSystemTick());
+        m_telemetry.capture_to_send.Record((now - release_ns) / 1000);
 
-    return rc;
-}
+        // What a period costs us, to tell what idling saves.
+        s64 cost_ns = now - start_ns;
+        m_period_cost_ns += (cost_ns - m_period_cost_ns) / 16;
 
-Result BtAudioDevice::ApplyVolume(void* buf)
-{
-    SetSysAudioVolume vol;
-    Result rc = setsysGetAudioVolume(SetSysAudioDevice_Console, &vol);
+        // Enough silence in a row: stop sending it. The periods already
+        // queued still go out.
+        m_silent_ns = is_silent ? m_silent_ns + m_period_ns : 0;
 
-    if (R_FAILED(rc))
-        return rc;
+        if (m_idle_after_ns != 0 && m_silent_ns >= m_idle_after_ns && !m_is_idle) {
+            TRACE("[?] idle after %lu ms of silence\n", m_silent_ns / 1000000);
+            m_is_idle = true;
+        }
 
-    if (vol.volume > 15)
-        fatalThrow(0x1111);
+        if (m_is_drift_corrected) {
+            m_drift.Update(release_ns, now);
+            m_resampler.SetCorrection(m_drift.GetCorrectionPpm());
+            m_telemetry.drift_ppm.store(m_drift.GetDriftPpm(), std::memory_order_relaxed);
+        }
 
-    // Here's how I arrived at that number.
-    // x^0 = 1
-    // x^15 = 1/128
-    // x = 0.7236346187201891
+        if (m_last_send_ns != 0) {
+            u64 interval = now - m_last_send_ns;
+            u64 jitter = interval > m_period_ns ? interval - m_period_ns : m_period_ns - interval;
+            m_telemetry.send_jitter.Record(jitter / 1000);
+        }
 
-    float volume = powf(0.7236f, 15 - vol.volume);
+        if (m_last_send_ns == 0) {
+            m_telemetry.first_audio_ms.store((now - m_open_ns) / 1000000, std::memory_order_relaxed);
 
-    if (vol.volume == 0)
-        volume = 0;
+            // Only the first device back after a wake-up counts.
+            BtSystemTelemetry& stats = g_telemetry.System();
+            u64 wake_ns = stats.wake_ns.exchange(0, std::memory_order_relaxed);
 
-    s16* pcm = (s16*) buf;
+            if (wake_ns != 0)
+                stats.wake_to_audio.Record((now - wake_ns) / 1000000);
+        }
 
-    size_t i;
-    for (i=0; i<SAMPLES_PER_BUF; i+=4) {
-        int16x4_t   tmp0 = vld1_s16(pcm + i);         // Load four s16.
-        int32x4_t   tmp1 = vmovl_s16(tmp0);           // Convert them into four s32.
-        float32x4_t tmp2 = vcvtq_f32_s32(tmp1);       // Convert them into float.
-        float32x4_t tmp3 = vmulq_n_f32(tmp2, volume); // Multiply each by volume.
-        int32x4_t   tmp4 = vcvtq_s32_f32(tmp3);       // Convert back into s32.
-        int16x4_t   tmp5 = vqmovn_s32(tmp4);          // Convert back into s16 (saturated!).
-        vst1_s16(pcm + i, tmp5);                      // Store them back.
+        m_last_send_ns = now;
+        BtDeviceTelemetry::Bump(m_telemetry.periods_sent);
     }
+}
 
-    return rc;
+bool BtAudioDevice::DrainIdle(u64 now)
+{
+    // The first period with sound in it ends idling, and goes out at the
+    // usual delay, behind what we kept queued.
+    BtPcmPeriod* last = m_ring.Back();
+
+    if (last != NULL && !last->is_silent) {
+        TRACE("[?] resuming after %lu ms idle\n", m_silent_ns / 1000000);
+        m_is_idle = false;
+        m_silent_ns = 0;
+        return false;
+    }
+
+    // Drift correction steers the queue to where it settled, so keep that
+    // much of it; everything else is dropped unsent.
+    u32 keep = m_is_drift_corrected ? m_prebuffer_periods : 0;
+    BtPcmPeriod* period;
+
+    while (m_ring.GetFill() > keep && (period = m_ring.Front()) != NULL) {
+        m_ring.Pop();
+        period->Release();
+
+        m_silent_ns += m_period_ns;
+        m_idle_ns += m_period_ns;
+        m_idle_saved_ns += m_period_cost_ns;
+    }
+
+    m_telemetry.idle_ms.store(m_idle_ns / 1000000, std::memory_order_relaxed);
+    m_telemetry.idle_saved_us.store(m_idle_saved_ns / 1000, std::memory_order_relaxed);
+
+    // The headset is meant to run dry; that's no underrun.
+    m_last_send_ns = now;
+    return true;
 }
 
-void BtAudioDevice::WorkerThread()
+void BtAudioDevice::SendThread()
 {
     bool running = true;
     Result rc = 0;
 
-    TRACE("BtAudioDevice::WorkerThread\n");
-
-    size_t i;
-    for (i=0; i<NUM_BUF; i++) {
-        QueueBuffer(m_buffers[i]);
-    }
+    TRACE("BtAudioDevice::SendThread\n");
 
     while (running)
     {
@@ -442,7 +556,7 @@ void BtAudioDevice::WorkerThread()
             &idx, -1,
             waiterForUEvent(&m_workthread_exitsignal),
             waiterForEvent(&m_btdrv_statechange_event),
-            waiterForEvent(&m_audrec_buffer_event));
+            waiterForUEvent(&m_ring_signal));
 
         if (R_FAILED(rc)) {
             fatalThrow(rc);
@@ -455,14 +569,15 @@ void BtAudioDevice::WorkerThread()
                 break;
 
             case 1: // m_btdrv_statechange_event
-                mutexLock(&g_btdrv_mutex);
                 rc = btdrvGetAudioOutState(m_btdrv_handle, &m_btdrv_state);
-                mutexUnlock(&g_btdrv_mutex);
                 break;
 
-            case 2: // m_audrec_buffer_event
-                rc = AudioReceived();
+            case 2: // m_ring_signal
+                DrainRing();
                 break;
         }
     }
+
+    TRACE("[?] send ring: %u/%u high water, %lu overruns, %lu underruns\n",
+        m_ring.GetHighWater(), m_ring.GetCapacity(), m_ring.GetOverruns(), m_ring.GetUnderruns());
 }
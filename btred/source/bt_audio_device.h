@@ -1,57 +1,154 @@
 #pragma once
 
-#define NUM_BUF 8
-#define SAMPLES_PER_BUF 0x400 // 0x800
-#define BUF_SIZE (SAMPLES_PER_BUF * sizeof(u16))
-#define TOTAL_SIZE (NUM_BUF * BUF_SIZE)
+#include <atomic>
+#include "bt_audio_format.h"
+#include "bt_capture.h"
+#include "bt_config.h"
+#include "bt_drift_estimator.h"
+#include "bt_driver_lock.h"
+#include "bt_parked_thread.h"
+#include "bt_pcm_ring.h"
+#include "bt_resampler.h"
+#include "bt_telemetry.h"
+
+// How far a device got. Moves forward only, and is driven by the manager's
+// BtDeviceWorker: Open() enters Connecting, Start() goes through Starting to
+// Streaming, and the destructor is Stopping. A failed Open() or Start()
+// ends in Stopped, and the manager then drops the device.
+enum class BtDeviceState {
+    Connecting,     // audio out opened, waiting for it to become ready
+    Starting,
+    Streaming,
+    Stopping,
+    Stopped,
+};
+
+// Everything a device needs that would otherwise come from the heap on every
+// connect. Reserved once, by g_device_pool.
+#define SEND_STACK_SIZE 0x4000
+
+struct BtDeviceResources {
+    BtParkedThread* send_thread;
+    void*         send_stack;   // SEND_STACK_SIZE, page aligned
+    BtPcmPeriod** ring_slots;
+    size_t        ring_periods;
+
+    // For converting to the tuned sample rate, and for following the
+    // headset's clock at the capture rate; NULL where the tuning doesn't
+    // need them.
+    const DspResampleFilter* resample_filter;
+    const DspResampleFilter* drift_filter;
+    void*         resample_mem;   // BtResampler::MemSize, for either
+
+    // A period, for the routing's and EQ's output.
+    s16*          eq_mem;
+};
+
+// How long to wait for the audio out to become ready before starting it
+// anyway. This used to be an unconditional sleep. It is ready once btdrv
+// turned it to started by itself, when the headset's stream is up; its state
+// event fires on the way there, too.
+#define BTDRV_READY_TIMEOUT_NS 2000000000ULL
+#define BTDRV_READY_STATE BtdrvAudioOutState_Started
 
 class BtAudioDevice {
 public:
-    BtAudioDevice(BtdrvAddress addr);
+    BtAudioDevice(BtdrvAddress addr, const BtDeviceResources& resources);
     ~BtAudioDevice();
 
-    Result Initialize();
+    Result Open();
+    Result Start();
+
+    BtDeviceState GetState() const { return m_state.load(); }
+
+    // Between Open() and Start(): IsReady() reads the state, right after
+    // Open() and whenever GetReadyEvent() fires.
+    bool   IsReady();
+    Event* GetReadyEvent() { return &m_btdrv_statechange_event; }
+    u64    GetReadyDeadline() const { return m_opened_ns + BTDRV_READY_TIMEOUT_NS; }
 
 private:
     Result InitializeBtdrv();
+    Result StartBtdrv();
     void   FinalizeBtdrv();
-    Result InitializeAudrec();
-    void   FinalizeAudrec();
     Result InitializeBuffers();
     void   FinalizeBuffers();
     Result InitializeThread();
     void   FinalizeThread();
 
-    Result QueueBuffer(void* buf);
-    Result AudioReceived();
-    Result SendAudio(void* buf);
-    Result ApplyVolume(void* buf);
-    Result RefreshAudrec();
+    Result SendAudio(const void* buf, AudioBytes size);
+    void   DrainRing();
+
+    // While idle; false once there is sound to send again.
+    bool   DrainIdle(u64 now);
 
-    static void WorkerThreadTrampoline(BtAudioDevice* self) {
-        self->WorkerThread();
+    // Periods arrive from g_capture through the ring, and are sent to btdrv
+    // from here. Runs on the slot's parked thread while the device streams.
+    static void SendThreadTrampoline(BtAudioDevice* self) {
+        self->SendThread();
     }
-    void WorkerThread();
+    void SendThread();
 
 private:
     BtdrvAddress m_addr;
+    BtDeviceResources m_resources;
+
+    // Sizes are fixed for the device's lifetime, and all derived from the
+    // capture format and the period length.
+    BtAudioTuning m_tuning;
+    BtAudioFormat m_format;
+    AudioFrames  m_period;
+    AudioSamples m_period_samples;
+    AudioBytes   m_period_bytes;
+    u64    m_period_ns;
+
+    // What the audio out was started at. Unless that is m_format, or drift
+    // is corrected, periods are converted on the send thread.
+    BtAudioFormat m_out_format;
+    bool   m_is_resampling;
+    BtResampler m_resampler;
+
+    // The headset's own channel mode and EQ, applied at the capture rate
+    // before anything else, each a pass of its own when it's on.
+    DspRouting m_channels;
+    DspEqState m_eq;
+
+    // Drift correction needs a queue that can move both ways: sending holds
+    // off until m_prebuffer_periods are in the ring, at start and after an
+    // underrun.
+    bool   m_is_drift_corrected;
+    bool   m_is_prebuffering;
+    u32    m_prebuffer_periods;
+    BtDriftEstimator m_drift;
 
     bool   m_is_btdrv_initialized;
     u32    m_btdrv_handle;
     Event  m_btdrv_statechange_event;
     BtdrvAudioOutState m_btdrv_state;
 
-    bool   m_is_audrec_initialized;
-    AudrecRecorder m_audrec_recorder;
-    Event  m_audrec_buffer_event;
-
     bool   m_are_buffers_initialized;
-    void*  m_buffers[NUM_BUF];
-    void*  m_buffer_mem;
+    BtPcmRing m_ring;
 
     bool   m_is_thread_initialized;
-    Thread m_workthread;
-    void*  m_workthread_stack;
     UEvent m_workthread_exitsignal;
-};
+    UEvent m_ring_signal;
+    u64    m_last_send_ns;
+
+    // Sends pause after m_idle_after_ns of silence, and resume with the
+    // first period that isn't. Send thread only.
+    u64    m_idle_after_ns;
+    bool   m_is_idle;
+    u64    m_silent_ns;
+    s64    m_period_cost_ns;    // averaged
+    u64    m_idle_ns;
+    u64    m_idle_saved_ns;
+
+    bool   m_is_capture_attached;
+    BtCaptureSink m_capture_sink;
 
+    BtDeviceTelemetry m_telemetry;
+    u64    m_open_ns;           // bring-up start, for first_audio_ms
+    u64    m_opened_ns;         // audio out opened
+
+    std::atomic<BtDeviceState> m_state;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+// Sizes and durations of interleaved PCM. Frames, samples and bytes are
+// distinct types, so they only convert into each other through a format,
+// and every time/size calculation in the pipeline derives from one place.
+//
+// A frame is one sample for each channel; a 0x400 sample stereo buffer is
+// 0x200 frames, or 10.67 ms at 48 kHz.
+
+struct AudioFrames  { u64 count; };
+struct AudioSamples { u64 count; };
+struct AudioBytes   { u64 count; };
+
+struct BtAudioFormat {
+    u32 sample_rate;
+    u32 channel_count;
+    u32 bytes_per_sample;
+
+    constexpr AudioSamples ToSamples(AudioFrames f) const {
+        return { f.count * channel_count };
+    }
+
+    constexpr AudioBytes ToBytes(AudioFrames f) const {
+        return { f.count * channel_count * bytes_per_sample };
+    }
+
+    constexpr AudioFrames ToFrames(AudioSamples s) const {
+        return { s.count / channel_count };
+    }
+
+    constexpr AudioFrames ToFrames(AudioBytes b) const {
+        return { b.count / (channel_count * bytes_per_sample) };
+    }
+
+    constexpr u64 ToNs(AudioFrames f) const {
+        return (f.count * 1000000000ULL) / sample_rate;
+    }
+
+    // Rounds up, so that a buffer of FramesIn(ns) frames covers ns.
+    constexpr AudioFrames FramesIn(u64 ns) const {
+        return { (ns * sample_rate + 999999999ULL) / 1000000000ULL };
+    }
+
+    constexpr bool operator==(const BtAudioFormat&) const = default;
+};
+
+// What audrec's final output recorder delivers.
+#define AUDIO_FORMAT_CAPTURE (BtAudioFormat{48000, 2, sizeof(s16)})
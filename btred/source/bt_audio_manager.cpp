@@ -4,7 +4,11 @@
 #include <malloc.h>
 #include <switch.h>
 #include "bt_audio_manager.h"
+#include "bt_capture.h"
 #include "bt_config.h"
+#include "bt_device_pool.h"
+#include "bt_driver_lock.h"
+#include "bt_telemetry.h"
 
 //#define ENABLE_TRACE
 
@@ -22,16 +26,19 @@ bool operator <(BtdrvAddress const& left, BtdrvAddress const& right) {
 
 BtAudioManager g_audio_manager;
 
+// How long the capture is kept running after a wake-up, waiting for the
+// headset to come back.
+#define CAPTURE_HOLD_NS (30000000000ULL)
+
 
 BtAudioManager::BtAudioManager():
     m_is_initialized(false),
     m_psc_listener(this),
-    m_is_first_connect(true)
+    m_is_first_connect(true),
+    m_is_capture_held(false)
 {
-    utimerCreate(&m_reconnect_timer, 1000000000ULL * 10, TimerType_Repeating);
-    utimerStart(&m_reconnect_timer);
-
     utimerCreate(&m_connect_workaround_timer, 1000000000ULL * 5, TimerType_OneShot);
+    utimerCreate(&m_capture_hold_timer, CAPTURE_HOLD_NS, TimerType_OneShot);
 
     mutexInit(&m_suspend_mutex);
 }
@@ -72,9 +79,20 @@ Result BtAudioManager::Initialize()
         return rc;
     }
 
+    rc = m_worker.Initialize();
+
+    if (R_FAILED(rc)) {
+        audctlExit();
+        eventClose(&m_btdrv_audio_info_event);
+        eventClose(&m_btdrv_audio_connection_event);
+        btdrvExit();
+        return rc;
+    }
+
     rc = m_psc_listener.Initialize();
 
     if (R_FAILED(rc)) {
+        m_worker.Finalize();
         audctlExit();
         eventClose(&m_btdrv_audio_info_event);
         eventClose(&m_btdrv_audio_connection_event);
@@ -91,10 +109,14 @@ Result BtAudioManager::Initialize()
 
 BtAudioManager::~BtAudioManager()
 {
-    m_devices.clear();
-
     if (m_is_initialized) {
         m_psc_listener.Finalize();
+
+        for (auto it = m_devices.begin(); it != m_devices.end(); )
+            RemoveDevice(it++);
+
+        m_worker.WaitIdle();
+        m_worker.Finalize();
         audctlExit();
         eventClose(&m_btdrv_audio_info_event);
         eventClose(&m_btdrv_audio_connection_event);
@@ -108,20 +130,37 @@ void BtAudioManager::PollEvents()
     Result rc;
     int idx;
 
+    // The reconnect's state only changes on this thread, or during a
+    // suspend, under the lock.
+    mutexLock(&m_suspend_mutex);
+    u64 timeout = m_reconnect.GetTimeout();
+    mutexUnlock(&m_suspend_mutex);
+
     rc = waitMulti(
-        &idx, -1,
+        &idx, timeout,
         waiterForEvent(&m_btdrv_audio_connection_event),
         waiterForEvent(&m_btdrv_audio_info_event),
-        waiterForUTimer(&m_reconnect_timer),
-        waiterForUTimer(&m_connect_workaround_timer));
+        waiterForUEvent(m_reconnect.GetResumeEvent()),
+        waiterForUTimer(&m_connect_workaround_timer),
+        waiterForUEvent(m_worker.GetDoneEvent()),
+        waiterForUTimer(&m_capture_hold_timer));
 
-    if (R_FAILED(rc))
+    bool is_timeout = rc == KERNELRESULT(TimedOut);
+
+    if (R_FAILED(rc) && !is_timeout)
         fatalThrowWithPc(rc);
 
     mutexLock(&m_suspend_mutex);
 
+    if (is_timeout)
+        idx = -1;
+
     switch (idx)
     {
+        case -1: // the next reconnect attempt is due
+            m_reconnect.OnTimer();
+            break;
+
         case 0: // m_audio_connection_event
             RefreshDevices();
             break;
@@ -129,20 +168,26 @@ void BtAudioManager::PollEvents()
         case 1: // m_audio_info_event
             break;
 
-        case 2: // m_reconnect_timer
-            if (m_devices.size() == 0) {
-                if (g_config.HasHeadphonesBtAddress()) {
-                    mutexLock(&g_btdrv_mutex);
-                    btdrvOpenAudioConnection(g_config.GetHeadphonesBtAddress());
-                    mutexUnlock(&g_btdrv_mutex);
-                }
-            }
+        case 2: // woken up, see OnResume()
+            m_reconnect.OnResume();
             break;
 
         case 3: // m_connect_workaround_timer:
-            mutexLock(&g_btdrv_mutex);
+            g_btdrv_control_lock.Lock();
             btdrvCloseAudioConnection(g_config.GetHeadphonesBtAddress());
-            mutexUnlock(&g_btdrv_mutex);
+            g_btdrv_control_lock.Unlock();
+            break;
+
+        case 4: // m_worker done
+            OnDevicesChanged();
+            break;
+
+        case 5: // m_capture_hold_timer
+            // Nor does a later connect count as waking up.
+            TRACE("[?] nobody came back, releasing capture\n");
+            g_capture.Unhold();
+            m_is_capture_held = false;
+            g_telemetry.System().wake_ns.store(0, std::memory_order_relaxed);
             break;
     }
 
@@ -158,9 +203,9 @@ void BtAudioManager::RefreshDevices()
     BtdrvAddress audio_addrs[8] = {0};
     Result rc;
 
-    mutexLock(&g_btdrv_mutex);
+    g_btdrv_control_lock.Lock();
     rc = btdrvGetConnectedAudioDevice(audio_addrs, 8, &total_out);
-    mutexUnlock(&g_btdrv_mutex);
+    g_btdrv_control_lock.Unlock();
 
     TRACE("[?] btdrvGetConnectedAudioDevice: 0x%x, %d\n", rc, total_out);
 
@@ -177,25 +222,17 @@ void BtAudioManager::RefreshDevices()
             // This will be undone, at the end of the function.
             audctlSetSystemOutputMasterVolume(0);
 
+            // Comes up on the worker; OnDevicesChanged() hears about it.
             TRACE("[+] New audio source\n");
-            auto device = std::make_shared<BtAudioDevice>(btaddr);
-
-            rc = device->Initialize();
+            BtAudioDevice* device = g_device_pool.Acquire(btaddr);
 
-            if (R_FAILED(rc)) {
-                TRACE("[!] Failed to initialize device\n");
+            if (device == NULL) {
+                TRACE("[!] No free device slot\n");
                 continue;
             }
 
             m_devices[btaddr] = device;
-
-            if (m_is_first_connect) {
-                // For some headphones, a reconnect is required after the
-                // first connect.
-                // TODO: Investigate deeper.
-                m_is_first_connect = false;
-                utimerStart(&m_connect_workaround_timer);
-            }
+            m_worker.Start(device);
         }
     }
 
@@ -213,7 +250,7 @@ void BtAudioManager::RefreshDevices()
 
         if (!was_found) {
             TRACE("[-] Removed audio source\n");
-            it = m_devices.erase(it);
+            RemoveDevice(it++);
         }
         else {
             ++it;
@@ -222,6 +259,53 @@ void BtAudioManager::RefreshDevices()
 
     // Here we mute speakers if we have a bluetooth headset connected.
     audctlSetSystemOutputMasterVolume(m_devices.size() ? 0 : 1);
+
+    m_reconnect.Update(m_devices.size() != 0);
+}
+
+void BtAudioManager::OnDevicesChanged()
+{
+    bool has_failed = false;
+
+    for (auto it = m_devices.begin(); it != m_devices.end(); ) {
+        BtDeviceState state = it->second->GetState();
+
+        if (state == BtDeviceState::Stopped) {
+            TRACE("[!] Failed to initialize device\n");
+            RemoveDevice(it++);
+            has_failed = true;
+            continue;
+        }
+
+        if (state == BtDeviceState::Streaming && m_is_capture_held) {
+            // Attached to the capture that was kept across sleep.
+            utimerStop(&m_capture_hold_timer);
+            g_capture.Unhold();
+            m_is_capture_held = false;
+        }
+
+        if (state == BtDeviceState::Streaming && m_is_first_connect) {
+            // For some headphones, a reconnect is required after the
+            // first connect.
+            // TODO: Investigate deeper.
+            m_is_first_connect = false;
+            utimerStart(&m_connect_workaround_timer);
+        }
+
+        ++it;
+    }
+
+    if (has_failed) {
+        audctlSetSystemOutputMasterVolume(m_devices.size() ? 0 : 1);
+        m_reconnect.Update(m_devices.size() != 0);
+    }
+}
+
+void BtAudioManager::RemoveDevice(DeviceMap::iterator it)
+{
+    // The worker tears it down and returns it to the pool.
+    m_worker.Stop(it->second);
+    m_devices.erase(it);
 }
 
 void BtAudioManager::OnSuspend()
@@ -237,14 +321,29 @@ void BtAudioManager::OnSuspend()
 
     mutexLock(&m_suspend_mutex);
 
-    for (auto it = m_devices.begin(); it != m_devices.end(); ) {
-        it = m_devices.erase(it);
-    }
+    // Only the audio outs go; the capture stays warm for the wake-up.
+    g_capture.Hold();
+    utimerStop(&m_capture_hold_timer);
+    m_is_capture_held = true;
+
+    for (auto it = m_devices.begin(); it != m_devices.end(); )
+        RemoveDevice(it++);
+
+    // Devices still coming up are dropped rather than started.
+    m_worker.WaitIdle();
+
+    m_reconnect.Suspend();
 }
 
 void BtAudioManager::OnResume()
 {
     // Warning: This function is executed in the PSC event listener thread.
 
+    g_telemetry.System().wake_ns.store(armTicksToNs(svcGetSystemTick()), std::memory_order_relaxed);
+
+    // Let go of the capture if the headset doesn't come back.
+    utimerStart(&m_capture_hold_timer);
+
+    m_reconnect.Resume();
     mutexUnlock(&m_suspend_mutex);
 }
\ No newline at end of file
@@ -1,11 +1,13 @@
 #pragma once
 
 #include <map>
-#include <memory>
 #include "bt_audio_device.h"
+#include "bt_device_worker.h"
 #include "bt_psc_listener.h"
+#include "bt_reconnect.h"
 
-typedef std::map<BtdrvAddress, std::shared_ptr<BtAudioDevice>> DeviceMap;
+// Devices live in g_device_pool; the manager only tracks which are its own.
+typedef std::map<BtdrvAddress, BtAudioDevice*> DeviceMap;
 
 class BtAudioManager {
 public:
@@ -17,6 +19,8 @@ public:
 
 private:
     void RefreshDevices();
+    void OnDevicesChanged();
+    void RemoveDevice(DeviceMap::iterator it);
 
 protected:
     friend class BtPscListener;
@@ -30,11 +34,13 @@ private:
     Event     m_btdrv_audio_info_event;
     Event     m_btdrv_audio_connection_event;
     DeviceMap m_devices;
-    UTimer    m_reconnect_timer;
+    BtDeviceWorker m_worker;
+    BtReconnect m_reconnect;
     BtPscListener m_psc_listener;
     UTimer    m_connect_workaround_timer;
     bool      m_is_first_connect;
+    UTimer    m_capture_hold_timer;
+    bool      m_is_capture_held;
 };
 
-extern Mutex g_btdrv_mutex;
 extern BtAudioManager g_audio_manager;
@@ -0,0 +1,567 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <switch.h>
+#include "bt_capture.h"
+#include "bt_dsp.h"
+#include "bt_volume.h"
+
+//#define ENABLE_TRACE
+
+#ifdef ENABLE_TRACE
+#define TRACE(...) printf(__VA_ARGS__)
+#else
+#define TRACE(...)
+#endif
+
+BtCapture g_capture;
+
+
+BtCapture::BtCapture():
+    m_sinks{},
+    m_num_sinks(0),
+    m_is_held(false),
+    m_is_audrec_initialized(false),
+    m_resources{},
+    m_are_buffers_initialized(false),
+    m_pool(NULL),
+    m_pool_size(0),
+    m_is_thread_initialized(false),
+    m_gain(0),
+    m_limiter{},
+    m_resync_failures(0)
+{
+    mutexInit(&m_control_mutex);
+    mutexInit(&m_sinks_mutex);
+}
+
+BtCapture::~BtCapture()
+{
+    Stop();
+
+    // Parked by now.
+    m_capture_thread.Finalize();
+}
+
+void BtCapture::SetResources(const BtCaptureResources& resources)
+{
+    m_resources = resources;
+}
+
+void BtCapture::ClearResources()
+{
+    m_capture_thread.Finalize();
+    m_resources = {};
+}
+
+// The limiter's ceiling, in Q15, from its level in dB below full scale.
+static s16 LimiterCeiling(const BtAudioTuning& tuning)
+{
+    return DspGainToQ15(powf(10.0f, -(float)tuning.limiter_ceiling_db / 20.0f));
+}
+
+size_t BtCapture::RingPeriods(const BtAudioTuning& tuning, const BtAudioFormat& format)
+{
+    AudioFrames period = format.ToFrames(AudioSamples{tuning.period_samples});
+
+    // Round the ring up to whole periods.
+    AudioFrames ring_frames = format.FramesIn(tuning.ring_depth_ms * 1000000ULL);
+    size_t ring_periods = (ring_frames.count + period.count - 1) / period.count;
+
+    return ring_periods != 0 ? ring_periods : 1;
+}
+
+Result BtCapture::Attach(BtCaptureSink* sink)
+{
+    Result rc = 0;
+
+    mutexLock(&m_control_mutex);
+
+    if (m_num_sinks == CAPTURE_MAX_SINKS) {
+        mutexUnlock(&m_control_mutex);
+        return -1;
+    }
+
+    if (m_num_sinks == 0 && !m_is_thread_initialized) {
+        rc = Start();
+
+        if (R_FAILED(rc)) {
+            mutexUnlock(&m_control_mutex);
+            return rc;
+        }
+    }
+
+    mutexLock(&m_sinks_mutex);
+    m_sinks[m_num_sinks++] = sink;
+    mutexUnlock(&m_sinks_mutex);
+
+    mutexUnlock(&m_control_mutex);
+    return rc;
+}
+
+void BtCapture::Detach(BtCaptureSink* sink)
+{
+    mutexLock(&m_control_mutex);
+    mutexLock(&m_sinks_mutex);
+
+    size_t i;
+    for (i=0; i<m_num_sinks; i++) {
+        if (m_sinks[i] == sink) {
+            m_sinks[i] = m_sinks[--m_num_sinks];
+            m_sinks[m_num_sinks] = NULL;
+            break;
+        }
+    }
+
+    mutexUnlock(&m_sinks_mutex);
+
+    // The capture thread no longer pushes to it, and the send thread is gone,
+    // so we are the ring's only user.
+    BtPcmPeriod* period;
+    while ((period = sink->ring->Front()) != NULL) {
+        period->Release();
+        sink->ring->Pop();
+    }
+
+    if (m_num_sinks == 0 && !m_is_held)
+        Stop();
+
+    mutexUnlock(&m_control_mutex);
+}
+
+void BtCapture::Hold()
+{
+    mutexLock(&m_control_mutex);
+    m_is_held = m_is_thread_initialized;
+    mutexUnlock(&m_control_mutex);
+}
+
+void BtCapture::Unhold()
+{
+    mutexLock(&m_control_mutex);
+
+    if (m_is_held && m_num_sinks == 0)
+        Stop();
+
+    m_is_held = false;
+    mutexUnlock(&m_control_mutex);
+}
+
+Result BtCapture::Start()
+{
+    Result rc;
+
+    m_tuning = g_config.GetAudioTuning();
+    m_format = AUDIO_FORMAT_CAPTURE;
+    m_period = m_format.ToFrames(AudioSamples{m_tuning.period_samples});
+    m_period_samples = m_format.ToSamples(m_period);
+    m_period_bytes = m_format.ToBytes(m_period);
+    m_period_ns = m_format.ToNs(m_period);
+    m_gain = 0;
+    // A ceiling of 0 dB is full scale, which turns the limiting off; the
+    // safety mute stays on.
+    DspLimiterInit(&m_limiter, LimiterCeiling(m_tuning), m_format.sample_rate);
+    m_resync_failures = 0;
+
+    rc = InitializeAudrec();
+
+    if (R_FAILED(rc)) {
+        return rc;
+    }
+
+    rc = InitializeBuffers();
+
+    if (R_FAILED(rc)) {
+        FinalizeAudrec();
+        return rc;
+    }
+
+    rc = InitializeThread();
+
+    if (R_FAILED(rc)) {
+        FinalizeBuffers();
+        FinalizeAudrec();
+        return rc;
+    }
+
+    return rc;
+}
+
+void BtCapture::Stop()
+{
+    FinalizeThread();
+    FinalizeBuffers();
+    FinalizeAudrec();
+}
+
+Result BtCapture::InitializeAudrec()
+{
+    Result rc;
+
+    rc = audrecInitialize();
+
+    if (R_FAILED(rc)) {
+        return rc;
+    }
+
+    FinalOutputRecorderParameter param_in;
+    param_in.sample_rate = m_format.sample_rate;
+    param_in.channel_count = m_format.channel_count;
+
+    FinalOutputRecorderParameterInternal param_out;
+    rc = audrecOpenFinalOutputRecorder(&m_audrec_recorder, &param_in, 0, &param_out);
+
+    if (R_FAILED(rc)) {
+        audrecExit();
+        return rc;
+    }
+
+    if (param_out.sample_rate != m_format.sample_rate) {
+        audrecExit();
+        return -1;
+    }
+
+    if (param_out.channel_count != m_format.channel_count) {
+        audrecExit();
+        return -1;
+    }
+
+    if (param_out.sample_format != 2) { //PcmInt16
+        audrecExit();
+        return -1;
+    }
+
+    TRACE("sample_rate: %u\n", param_out.sample_rate);
+    TRACE("channel_count: %u\n", param_out.channel_count);
+    TRACE("sample_format: %u\n", param_out.sample_format);
+    TRACE("state: %u\n", param_out.state);
+
+    rc = audrecRecorderStart(&m_audrec_recorder);
+
+    if (R_FAILED(rc)) {
+        audrecRecorderClose(&m_audrec_recorder);
+        audrecExit();
+        return rc;
+    }
+
+    rc = audrecRecorderRegisterBufferEvent(&m_audrec_recorder, &m_audrec_buffer_event);
+
+    if (R_FAILED(rc)) {
+        audrecRecorderStop(&m_audrec_recorder);
+        audrecRecorderClose(&m_audrec_recorder);
+        audrecExit();
+        return rc;
+    }
+
+    m_is_audrec_initialized = true;
+
+    return rc;
+}
+
+void BtCapture::FinalizeAudrec()
+{
+    if (m_is_audrec_initialized) {
+        eventClose(&m_audrec_buffer_event);
+        audrecRecorderStop(&m_audrec_recorder);
+        audrecRecorderClose(&m_audrec_recorder);
+        audrecExit();
+        m_is_audrec_initialized = false;
+    }
+}
+
+Result BtCapture::InitializeBuffers()
+{
+    // Sized for this tuning at boot. Every period came back with the last
+    // Detach(), so the pool is free again.
+    if (m_resources.buffer_mem == NULL || m_resources.pool == NULL || m_resources.thread_stack == NULL)
+        return -1;
+
+    size_t i;
+    for (i=0; i<m_tuning.num_buffers; i++) {
+        m_buffers[i] = (void*)((u8*)m_resources.buffer_mem + i*m_period_bytes.count);
+    }
+
+    m_pool = m_resources.pool;
+    m_pool_size = m_resources.pool_size;
+    m_pool_next = 0;
+
+    m_are_buffers_initialized = true;
+    return 0;
+}
+
+void BtCapture::FinalizeBuffers()
+{
+    m_are_buffers_initialized = false;
+}
+
+Result BtCapture::InitializeThread()
+{
+    // Preempts the devices' send threads (0x2C) on the same core, so that
+    // audrec always gets its buffers back.
+    #define CapturePrio 0x2B
+    #define CaptureCore 3
+    Result rc = 0;
+
+    // Created with the first capture session, then parked between them.
+    if (!m_capture_thread.IsInitialized()) {
+        rc = m_capture_thread.Initialize(m_resources.thread_stack, CAPTURE_STACK_SIZE, CapturePrio, CaptureCore);
+
+        if (R_FAILED(rc)) {
+            return rc;
+        }
+    }
+
+    ueventCreate(&m_workthread_exitsignal, false);
+
+    m_capture_thread.Run((ThreadFunc) CaptureThreadTrampoline, (void*) this);
+
+    m_is_thread_initialized = true;
+
+    return rc;
+}
+
+void BtCapture::FinalizeThread()
+{
+    if (m_is_thread_initialized) {
+        ueventSignal(&m_workthread_exitsignal);
+        m_capture_thread.Join();
+        m_is_thread_initialized = false;
+    }
+}
+
+Result BtCapture::RefreshAudrec()
+{
+    Result rc;
+
+    FinalizeAudrec();
+
+    rc = InitializeAudrec();
+
+    if (R_FAILED(rc))
+        return rc;
+
+    size_t i;
+    for (i=0; i<m_tuning.num_buffers; i++) {
+        QueueBuffer(m_buffers[i]);
+    }
+
+    return rc;
+}
+
+Result BtCapture::QueueBuffer(void* buf)
+{
+    FinalOutputRecorderBuffer param;
+    param.released_ns = 0;
+    param.next_buffer_ptr = 0;
+    param.sample_buffer_ptr = (u64)buf;
+    param.sample_buffer_capacity = m_period_bytes.count;
+    param.data_size = m_period_bytes.count;
+    param.data_offset = 0;
+
+    return audrecRecorderAppendFinalOutputRecorderBuffer(&m_audrec_recorder, (u64)buf, &param);
+}
+
+BtPcmPeriod* BtCapture::AllocPeriod()
+{
+    size_t i;
+    for (i=0; i<m_pool_size; i++) {
+        BtPcmPeriod* period = &m_pool[m_pool_next];
+        m_pool_next = (m_pool_next + 1) % m_pool_size;
+
+        // Acquire pairs with the last Release(), so its reader is done.
+        if (period->refs.load(std::memory_order_acquire) == 0)
+            return period;
+    }
+
+    return NULL;
+}
+
+void BtCapture::FanOut(BtPcmPeriod* period)
+{
+    mutexLock(&m_sinks_mutex);
+
+    // One reference per device, plus ours until every push is done, so that
+    // a fast device can't hand the period back while we're still pushing.
+    period->refs.store(m_num_sinks + 1, std::memory_order_relaxed);
+
+    size_t i;
+    for (i=0; i<m_num_sinks; i++) {
+        BtCaptureSink* sink = m_sinks[i];
+        sink->telemetry->capture_to_gain.Record((period->gain_ns - period->release_ns) / 1000);
+
+        if (sink->ring->Push(period)) {
+            ueventSignal(sink->signal);
+        }
+        else {
+            period->Release();
+            sink->telemetry->overruns.store(sink->ring->GetOverruns(), std::memory_order_relaxed);
+        }
+    }
+
+    mutexUnlock(&m_sinks_mutex);
+
+    period->Release();
+}
+
+void BtCapture::CountEvent(std::atomic<u64> BtDeviceTelemetry::* counter)
+{
+    mutexLock(&m_sinks_mutex);
+
+    size_t i;
+    for (i=0; i<m_num_sinks; i++) {
+        BtDeviceTelemetry::Bump(m_sinks[i]->telemetry->*counter);
+    }
+
+    mutexUnlock(&m_sinks_mutex);
+}
+
+Result BtCapture::AudioReceived()
+{
+    #define TWO_PERIODS (2*m_period_ns)
+    // How many wake-ups in a row may lag before we give up on resyncing and
+    // tear the recorder down.
+    #define MAX_RESYNC_FAILURES 4
+
+    u64 buffers[TUNING_MAX_BUFFERS];
+    u64 count = m_tuning.num_buffers;
+    u64 released = 0;
+    Result rc;
+
+    rc = audrecRecorderGetReleasedFinalOutputRecorderBuffers(&m_audrec_recorder, buffers, &count, &released);
+
+    if (R_FAILED(rc))
+        return ResyncFailed(rc);
+
+    // If audrec gets out of sync (when switching apps), it hands us a burst
+    // of buffers, and/or buffers that were released a while ago. Rather than
+    // refreshing it, send the ones that are still fresh, drop the stale ones
+    // and give them all back.
+    // Without buffers, there is no timestamp to go by either.
+    u64 now = armTicksToNs(svcGetSystemTick());
+    u64 lag = count != 0 && now > released ? now - released : 0;
+    bool is_lagging = lag > TWO_PERIODS;
+
+    if (count > 1 || is_lagging)
+        CountEvent(&BtDeviceTelemetry::resyncs);
+
+    // The gain pass doubles as the copy out of the audrec buffer, so that it
+    // goes straight back to audrec however slow btdrv is.
+    size_t i;
+    for (i=0; i<count; i++) {
+        void* buf = (void*) buffers[i];
+
+        // Buffers are released in order, one period apart; the last one
+        // carries the timestamp.
+        u64 age = lag + (count - 1 - i) * m_period_ns;
+
+        if (age > TWO_PERIODS) {
+            CountEvent(&BtDeviceTelemetry::stale_drops);
+        }
+        else {
+            // Only runs dry if every ring is full, and those count the
+            // overrun themselves.
+            BtPcmPeriod* period = AllocPeriod();
+
+            if (period != NULL) {
+                s16 peak = ApplyVolume(period->samples, buf);
+                period->is_silent = peak <= DSP_SILENCE_LEVEL;
+                period->release_ns = now - age;
+                period->gain_ns = armTicksToNs(svcGetSystemTick());
+                FanOut(period);
+            }
+        }
+
+        rc = QueueBuffer(buf);
+
+        if (R_FAILED(rc))
+            return ResyncFailed(rc);
+    }
+
+    if (is_lagging)
+        return ResyncFailed(rc);
+
+    m_resync_failures = 0;
+    return rc;
+}
+
+Result BtCapture::ResyncFailed(Result rc)
+{
+    // Only the expensive path if resyncing keeps failing.
+    if (++m_resync_failures < MAX_RESYNC_FAILURES)
+        return rc;
+
+    TRACE("[!] audrec out of sync, refreshing\n");
+
+    m_resync_failures = 0;
+    CountEvent(&BtDeviceTelemetry::refreshes);
+    return RefreshAudrec();
+}
+
+s16 BtCapture::ApplyVolume(s16* dst, const void* src)
+{
+    s16 gain = g_volume.GetGainQ15();
+
+    // Ramp over one buffer on volume changes, so the steps between the 16
+    // levels don't click.
+    if (gain != m_gain) {
+        DspApplyGainQ15Ramp(dst, (const s16*) src, m_period_samples.count, m_gain, gain);
+        m_gain = gain;
+    }
+    else {
+        DspApplyGainQ15(dst, (const s16*) src, m_period_samples.count, gain);
+    }
+
+    // The rest in place: the channel routing, only if there is any, then
+    // the safety detector and limiter.
+    if (m_tuning.channels != DspRouting::Stereo)
+        DspApplyRouting(dst, dst, m_period_samples.count, m_tuning.channels);
+
+    bool was_muted = m_limiter.is_muted;
+
+    DspApplyLimiter(dst, dst, m_period_samples.count, &m_limiter);
+
+    if (m_limiter.is_muted && !was_muted) {
+        TRACE("BtCapture: output at full scale or DC, muted\n");
+        CountEvent(&BtDeviceTelemetry::safety_mutes);
+    }
+
+    return DspPeak(dst, m_period_samples.count);
+}
+
+void BtCapture::CaptureThread()
+{
+    bool running = true;
+    Result rc = 0;
+
+    TRACE("BtCapture::CaptureThread\n");
+
+    size_t i;
+    for (i=0; i<m_tuning.num_buffers; i++) {
+        QueueBuffer(m_buffers[i]);
+    }
+
+    while (running)
+    {
+        int idx;
+
+        rc = waitMulti(
+            &idx, -1,
+            waiterForUEvent(&m_workthread_exitsignal),
+            waiterForEvent(&m_audrec_buffer_event));
+
+        if (R_FAILED(rc)) {
+            fatalThrow(rc);
+        }
+
+        switch (idx)
+        {
+            case 0: // m_workthread_exitsignal
+                running = false;
+                break;
+
+            case 1: // m_audrec_buffer_event
+                rc = AudioReceived();
+                break;
+        }
+    }
+}
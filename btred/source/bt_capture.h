@@ -0,0 +1,131 @@
+#pragma once
+
+#include "bt_audio_format.h"
+#include "bt_config.h"
+#include "bt_parked_thread.h"
+#include "bt_pcm_ring.h"
+#include "bt_telemetry.h"
+
+#define CAPTURE_MAX_SINKS TELEMETRY_MAX_DEVICES
+
+// Where a device receives its periods. The ring's consumer is the device's
+// send thread, which signals on *signal.
+struct BtCaptureSink {
+    BtPcmRing* ring;
+    UEvent* signal;
+    BtDeviceTelemetry* telemetry;
+};
+
+// Memory the capture runs in, reserved once at boot by g_device_pool, so that
+// starting and stopping it never touches the heap.
+#define CAPTURE_STACK_SIZE 0x4000
+
+struct BtCaptureResources {
+    void*  buffer_mem;      // num_buffers periods, queued to audrec
+    BtPcmPeriod* pool;      // with their samples, one period each
+    size_t pool_size;
+    void*  thread_stack;    // CAPTURE_STACK_SIZE
+};
+
+// The one audrec final output recorder, shared by all devices. Each period
+// is captured and gain-adjusted once, into a pooled buffer, and a reference
+// to it is pushed to every attached device's ring, so all headsets play the
+// same, sample-aligned stream.
+//
+// The recorder is opened when the first device attaches, and closed when the
+// last one detaches, unless it's held: across sleep it keeps running with no
+// devices, so that the headset reconnecting on wake finds it warm.
+class BtCapture {
+public:
+    BtCapture();
+    ~BtCapture();
+
+    Result Attach(BtCaptureSink* sink);
+
+    // The sink's send thread must already be stopped; references left in its
+    // ring are released here.
+    void   Detach(BtCaptureSink* sink);
+
+    // Hold() only holds a running capture; Unhold() stops it if nobody
+    // attached meanwhile.
+    void   Hold();
+    void   Unhold();
+
+    // Before the first Attach(), and after the last Detach(); the parked
+    // thread exits with its stack.
+    void   SetResources(const BtCaptureResources& resources);
+    void   ClearResources();
+
+    // Send ring depth, in periods, for the given tuning.
+    static size_t RingPeriods(const BtAudioTuning& tuning, const BtAudioFormat& format);
+
+private:
+    Result Start();
+    void   Stop();
+
+    Result InitializeAudrec();
+    void   FinalizeAudrec();
+    Result InitializeBuffers();
+    void   FinalizeBuffers();
+    Result InitializeThread();
+    void   FinalizeThread();
+
+    Result QueueBuffer(void* buf);
+    Result AudioReceived();
+    Result ResyncFailed(Result rc);
+    Result RefreshAudrec();
+    // Returns the peak of what it wrote, for telling silence apart.
+    s16    ApplyVolume(s16* dst, const void* src);
+
+    BtPcmPeriod* AllocPeriod();
+    void   FanOut(BtPcmPeriod* period);
+    void   CountEvent(std::atomic<u64> BtDeviceTelemetry::* counter);
+
+    static void CaptureThreadTrampoline(BtCapture* self) {
+        self->CaptureThread();
+    }
+    void CaptureThread();
+
+private:
+    // Serializes Attach/Detach, and with them starting and stopping.
+    Mutex  m_control_mutex;
+
+    // Guards the sink list against the capture thread.
+    Mutex  m_sinks_mutex;
+    BtCaptureSink* m_sinks[CAPTURE_MAX_SINKS];
+    size_t m_num_sinks;
+    bool   m_is_held;
+
+    // Snapshotted on Start().
+    BtAudioTuning m_tuning;
+    BtAudioFormat m_format;
+    AudioFrames  m_period;
+    AudioSamples m_period_samples;
+    AudioBytes   m_period_bytes;
+    u64    m_period_ns;
+
+    bool   m_is_audrec_initialized;
+    AudrecRecorder m_audrec_recorder;
+    Event  m_audrec_buffer_event;
+
+    BtCaptureResources m_resources;
+
+    bool   m_are_buffers_initialized;
+    void*  m_buffers[TUNING_MAX_BUFFERS];
+
+    // Periods are free when their refcount is zero. Only the capture thread
+    // allocates, so finding one is a scan from where the last one was taken.
+    BtPcmPeriod* m_pool;
+    size_t m_pool_size;
+    size_t m_pool_next;
+
+    bool   m_is_thread_initialized;
+    BtParkedThread m_capture_thread;
+    UEvent m_workthread_exitsignal;
+
+    s16    m_gain;
+    DspLimiterState m_limiter;
+    u32    m_resync_failures;
+};
+
+extern BtCapture g_capture;
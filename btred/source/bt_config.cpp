@@ -1,99 +1,825 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <malloc.h>
+#include <stddef.h>
 #include <sys/stat.h>
 #include <switch.h>
 #include "bt_config.h"
+#include "bt_telemetry.h"
+
+//#define ENABLE_TRACE
+
+#ifdef ENABLE_TRACE
+#define TRACE(...) printf(__VA_ARGS__)
+#else
+#define TRACE(...)
+#endif
 
 BtConfig g_config;
 #define NE(x, y) (memcmp(&(x), &(y), sizeof(x)) != 0)
 
+// devices.bin: a header, then one record per headset. The version goes up
+// when the layout changes incompatibly, so every version 1 record holds at
+// least a whole ConfigRecord. Fields added at the end of it later grow
+// record_size, and readers that don't know them skip them. The CRC covers
+// everything after the header, and a file that fails it is not used.
+#define CONFIG_MAGIC 0x46435442 // "BTCF"
+#define CONFIG_VERSION 1
+
+struct ConfigHeader {
+    u32 magic;
+    u16 version;
+    u16 header_size;
+    u32 record_size;
+    u32 num_records;
+    u32 crc;
+    BtdrvAddress last_addr;
+    u8  reserved[2];
+};
+
+struct ConfigBand {
+    u32   type;
+    float freq_hz;
+    float gain_db;
+    float q;
+};
+
+struct ConfigRecord {
+    BtdrvAddress addr;
+    u8  is_paired;
+    u8  channels;
+    u32 seq;
+    u32 ring_depth_ms;
+    u32 btdrv_latency_ms;
+    u32 num_bands;
+    ConfigBand bands[DSP_EQ_MAX_BANDS];
+    SetSysBluetoothDevicesSettings settings;
+};
+
+static_assert(sizeof(ConfigHeader) == 28, "devices.bin header layout");
+static_assert(offsetof(ConfigRecord, settings) == 152, "devices.bin record layout");
+static_assert(sizeof(ConfigRecord) == 152 + sizeof(SetSysBluetoothDevicesSettings), "devices.bin record layout");
+
+
+// Presets selectable with "preset = <name>" in tuning.ini. Individual keys
+// after it override single values.
+static const struct {
+    const char* name;
+    BtAudioTuning tuning;
+} g_tuning_presets[] = {
+    { "default",         {  8, 0x400,  4,  64, 48000, 300, DspRouting::Stereo, 1, 5000 } },
+    { "low_latency",     {  4, 0x200,  4,  16, 48000, 300, DspRouting::Stereo, 1, 5000 } },
+    { "high_robustness", { 12, 0x800, 20, 128, 48000, 300, DspRouting::Stereo, 1, 5000 } },
+};
+
+// Values of "channels = <name>".
+static const struct {
+    const char* name;
+    DspRouting routing;
+} g_channel_routings[] = {
+    { "stereo", DspRouting::Stereo },
+    { "mono",   DspRouting::Mono },
+    { "swap",   DspRouting::Swap },
+    { "left",   DspRouting::Left },
+    { "right",  DspRouting::Right },
+};
+
+// Band types in headsets.ini.
+static const struct {
+    const char* name;
+    DspEqType type;
+} g_eq_types[] = {
+    { "peak",       DspEqType::Peak },
+    { "low_shelf",  DspEqType::LowShelf },
+    { "high_shelf", DspEqType::HighShelf },
+    { "low_pass",   DspEqType::LowPass },
+    { "high_pass",  DspEqType::HighPass },
+};
+
+static u32 Clamp(u32 v, u32 lo, u32 hi)
+{
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+// CRC-32 (IEEE), bitwise; the file is small and read once.
+static u32 Crc32(u32 crc, const void* data, size_t size)
+{
+    const u8* p = (const u8*) data;
+    crc = ~crc;
+
+    while (size-- != 0) {
+        crc ^= *p++;
+
+        for (int i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+
+    return ~crc;
+}
+
+static const BtDeviceTuning g_default_device_tuning = {
+    CONFIG_TUNING_UNSET, CONFIG_TUNING_UNSET, DspRouting::Stereo, 0, {},
+};
+
+static const u32 g_sample_rates[] = TUNING_SAMPLE_RATES;
+
+static bool IsSupportedRate(u32 rate)
+{
+    for (u32 supported: g_sample_rates) {
+        if (rate == supported)
+            return true;
+    }
+
+    return false;
+}
+
 
 BtConfig::BtConfig():
-    m_btsettings{},
-    m_btaddr{}
-{ }
+    m_btaddr{},
+    m_tuning(g_tuning_presets[0].tuning),
+    m_devices{},
+    m_num_devices(0),
+    m_seq(0),
+    m_is_dirty(false),
+    m_is_writer_initialized(false),
+    m_writethread_stack(NULL)
+{
+    mutexInit(&m_mutex);
+}
 
-Result BtConfig::Initialize()
+BtConfig::~BtConfig()
+{
+    Finalize();
+}
+
+Result BtConfig::LoadTuning()
+{
+    FILE* fd = fopen("config/btred/tuning.ini", "r");
+
+    if (fd == NULL)
+        return 0;
+
+    char line[128];
+
+    while (fgets(line, sizeof(line), fd) != NULL) {
+        char key[32];
+        char value[32];
+
+        if (line[0] == '#' || line[0] == ';')
+            continue;
+
+        if (sscanf(line, " %31[^= \t] = %31s", key, value) != 2)
+            continue;
+
+        u32 num = strtoul(value, NULL, 0);
+
+        if (strcmp(key, "preset") == 0) {
+            for (auto& preset: g_tuning_presets) {
+                if (strcmp(value, preset.name) == 0)
+                    m_tuning = preset.tuning;
+            }
+        }
+        else if (strcmp(key, "num_buffers") == 0) {
+            m_tuning.num_buffers = num;
+        }
+        else if (strcmp(key, "period_samples") == 0) {
+            m_tuning.period_samples = num;
+        }
+        else if (strcmp(key, "btdrv_latency_ms") == 0) {
+            m_tuning.btdrv_latency_ms = num;
+        }
+        else if (strcmp(key, "ring_depth_ms") == 0) {
+            m_tuning.ring_depth_ms = num;
+        }
+        else if (strcmp(key, "sample_rate") == 0) {
+            m_tuning.sample_rate = num;
+        }
+        else if (strcmp(key, "drift_ppm") == 0) {
+            m_tuning.drift_ppm = num;
+        }
+        else if (strcmp(key, "channels") == 0) {
+            for (auto& channels: g_channel_routings) {
+                if (strcmp(value, channels.name) == 0)
+                    m_tuning.channels = channels.routing;
+            }
+        }
+        else if (strcmp(key, "limiter_ceiling_db") == 0) {
+            m_tuning.limiter_ceiling_db = num;
+        }
+        else if (strcmp(key, "idle_after_ms") == 0) {
+            m_tuning.idle_after_ms = num;
+        }
+    }
+
+    fclose(fd);
+
+    // The NEON kernels want whole 16-sample blocks.
+    m_tuning.num_buffers = Clamp(m_tuning.num_buffers, TUNING_MIN_BUFFERS, TUNING_MAX_BUFFERS);
+    m_tuning.period_samples = Clamp(m_tuning.period_samples & ~15u, TUNING_MIN_PERIOD_SAMPLES, TUNING_MAX_PERIOD_SAMPLES);
+    m_tuning.btdrv_latency_ms = Clamp(m_tuning.btdrv_latency_ms, TUNING_MIN_BTDRV_LATENCY_MS, TUNING_MAX_BTDRV_LATENCY_MS);
+    m_tuning.ring_depth_ms = Clamp(m_tuning.ring_depth_ms, 0, TUNING_MAX_RING_DEPTH_MS);
+    m_tuning.drift_ppm = Clamp(m_tuning.drift_ppm, 0, TUNING_MAX_DRIFT_PPM);
+    m_tuning.limiter_ceiling_db = Clamp(m_tuning.limiter_ceiling_db, 0, TUNING_MAX_LIMITER_CEILING_DB);
+    m_tuning.idle_after_ms = Clamp(m_tuning.idle_after_ms, 0, TUNING_MAX_IDLE_AFTER_MS);
+
+    if (!IsSupportedRate(m_tuning.sample_rate))
+        m_tuning.sample_rate = g_tuning_presets[0].tuning.sample_rate;
+
+    return 0;
+}
+
+static void ToRecord(const BtDeviceConfig& device, ConfigRecord* record)
+{
+    *record = {};
+    record->addr = device.addr;
+    record->is_paired = device.is_paired;
+    record->channels = (u8) device.tuning.channels;
+    record->seq = device.seq;
+    record->ring_depth_ms = device.tuning.ring_depth_ms;
+    record->btdrv_latency_ms = device.tuning.btdrv_latency_ms;
+    record->num_bands = device.tuning.num_bands;
+    record->settings = device.settings;
+
+    for (u32 i = 0; i < device.tuning.num_bands; i++) {
+        const DspEqBand& band = device.tuning.bands[i];
+        record->bands[i] = { (u32) band.type, band.freq_hz, band.gain_db, band.q };
+    }
+}
+
+static void FromRecord(const ConfigRecord& record, BtDeviceConfig* device)
+{
+    *device = {};
+    device->addr = record.addr;
+    device->is_paired = record.is_paired != 0;
+    device->seq = record.seq;
+    device->settings = record.settings;
+    device->tuning = g_default_device_tuning;
+
+    if (record.ring_depth_ms != CONFIG_TUNING_UNSET)
+        device->tuning.ring_depth_ms = Clamp(record.ring_depth_ms, 0, TUNING_MAX_RING_DEPTH_MS);
+
+    if (record.btdrv_latency_ms != CONFIG_TUNING_UNSET)
+        device->tuning.btdrv_latency_ms = Clamp(record.btdrv_latency_ms, TUNING_MIN_BTDRV_LATENCY_MS, TUNING_MAX_BTDRV_LATENCY_MS);
+
+    if (record.channels < sizeof(g_channel_routings) / sizeof(g_channel_routings[0]))
+        device->tuning.channels = (DspRouting) record.channels;
+
+    for (u32 i = 0; i < record.num_bands && i < DSP_EQ_MAX_BANDS; i++) {
+        const ConfigBand& band = record.bands[i];
+
+        if (band.type <= (u32) DspEqType::HighPass) {
+            device->tuning.bands[device->tuning.num_bands++] =
+                { (DspEqType) band.type, band.freq_hz, band.gain_db, band.q };
+        }
+    }
+}
+
+// Reads size bytes, into data if it isn't NULL, and runs them through crc.
+static bool ReadCrc(FILE* fd, void* data, size_t size, u32* crc)
+{
+    u8 skip[64];
+
+    while (size != 0) {
+        size_t chunk = data != NULL ? size : size < sizeof(skip) ? size : sizeof(skip);
+        u8* dst = data != NULL ? (u8*) data : skip;
+
+        if (fread(dst, 1, chunk, fd) != chunk)
+            return false;
+
+        *crc = Crc32(*crc, dst, chunk);
+        size -= chunk;
+
+        if (data != NULL)
+            data = dst + chunk;
+    }
+
+    return true;
+}
+
+bool BtConfig::ReadDevices(const char* path)
 {
-    bool needs_update = false;
+    FILE* fd = fopen(path, "rb");
+
+    if (fd == NULL)
+        return false;
+
+    ConfigHeader header{};
+    bool ok = fread(&header, sizeof(header), 1, fd) == 1 &&
+        header.magic == CONFIG_MAGIC && header.version == CONFIG_VERSION &&
+        header.header_size >= sizeof(header) && header.record_size >= sizeof(ConfigRecord) &&
+        header.num_records <= CONFIG_MAX_DEVICES &&
+        fseek(fd, header.header_size, SEEK_SET) == 0;
+
+    u32 crc = 0;
+    u32 num_devices = 0;
+    u32 seq = 0;
+
+    for (u32 i = 0; ok && i < header.num_records; i++) {
+        ConfigRecord record{};
+
+        ok = ReadCrc(fd, &record, sizeof(record), &crc) && ReadCrc(fd, NULL, header.record_size - sizeof(record), &crc);
+
+        if (ok) {
+            FromRecord(record, &m_devices[num_devices++]);
+            seq = record.seq > seq ? record.seq : seq;
+        }
+    }
+
+    fclose(fd);
 
+    if (!ok || crc != header.crc)
+        return false;
+
+    m_num_devices = num_devices;
+    m_seq = seq;
+    m_btaddr = header.last_addr;
+    return true;
+}
+
+// The single headset of the old settings.bin becomes the first entry.
+bool BtConfig::MigrateSettings()
+{
     FILE* fd = fopen("config/btred/settings.bin", "rb");
 
-    if (fd != NULL) {
-        SetSysBluetoothDevicesSettings settings_file{};
-        SetSysBluetoothDevicesSettings settings_current{};
-        SetSysBluetoothDevicesSettings settings_empty{};
+    if (fd == NULL)
+        return false;
 
-        fread(&settings_file, sizeof(SetSysBluetoothDevicesSettings), 1, fd);
+    SetSysBluetoothDevicesSettings settings{};
+    BtdrvAddress empty{};
+    bool ok = fread(&settings, sizeof(settings), 1, fd) == 1 && NE(settings.addr, empty);
 
-        Result rc;
-        rc = btdrvGetPairedDeviceInfo(m_btsettings.addr, &settings_current);
+    fclose(fd);
 
-        if (R_SUCCEEDED(rc)) {
-            m_btsettings = settings_current;
-            needs_update = needs_update || NE(settings_current, settings_file);
+    if (ok) {
+        BtDeviceConfig* device = AddDevice(settings.addr, true);
+        device->is_paired = true;
+        device->settings = settings;
+        device->seq = ++m_seq;
+        m_btaddr = settings.addr;
+        m_is_dirty = true;
+    }
+
+    return ok;
+}
+
+BtDeviceConfig* BtConfig::FindDevice(BtdrvAddress addr)
+{
+    for (u32 i = 0; i < m_num_devices; i++) {
+        if (!NE(m_devices[i].addr, addr))
+            return &m_devices[i];
+    }
+
+    return NULL;
+}
+
+// When the table is full, a headset that was never paired makes room first,
+// then, if allowed, the one used longest ago; never the last one, which the
+// reconnect goes for. NULL if none may.
+BtDeviceConfig* BtConfig::AddDevice(BtdrvAddress addr, bool can_evict_paired)
+{
+    BtDeviceConfig* device = NULL;
+
+    if (m_num_devices < CONFIG_MAX_DEVICES) {
+        device = &m_devices[m_num_devices++];
+    }
+    else {
+        for (auto& candidate: m_devices) {
+            if (!NE(candidate.addr, m_btaddr) || (candidate.is_paired && !can_evict_paired))
+                continue;
+
+            if (device == NULL || (device->is_paired && !candidate.is_paired) ||
+                (device->is_paired == candidate.is_paired && candidate.seq < device->seq))
+                device = &candidate;
         }
-        else {
-            m_btsettings = settings_file;
 
-            if (NE(settings_file, settings_empty)) {
-                rc = btdrvAddPairedDeviceInfo(&settings_file);
+        if (device == NULL)
+            return NULL;
+    }
+
+    // Only paired headsets are written out.
+    m_is_dirty = m_is_dirty || device->is_paired;
+
+    *device = {};
+    device->addr = addr;
+    device->tuning = g_default_device_tuning;
+    return device;
+}
+
+// While it is there, headsets.ini has the say over every headset's tuning:
+// those it doesn't list go back to tuning.ini's.
+void BtConfig::LoadHeadsets()
+{
+    FILE* fd = fopen("config/btred/headsets.ini", "r");
+
+    if (fd == NULL)
+        return;
+
+    BtDeviceTuning loaded[CONFIG_MAX_DEVICES];
+
+    for (u32 i = 0; i < m_num_devices; i++) {
+        loaded[i] = m_devices[i].tuning;
+        m_devices[i].tuning = g_default_device_tuning;
+    }
+
+    u32 num_loaded = m_num_devices;
+    BtDeviceTuning* tuning = NULL;
+    char line[128];
+
+    while (fgets(line, sizeof(line), fd) != NULL) {
+        BtdrvAddress addr;
+        char key[32];
+        char value[32];
+        char type[16];
+        DspEqBand band;
 
-                if (R_FAILED(rc))
-                    fatalThrow(rc);
+        if (line[0] == '#' || line[0] == ';')
+            continue;
+
+        u8* a = addr.address;
+
+        if (sscanf(line, " [%hhx:%hhx:%hhx:%hhx:%hhx:%hhx]", &a[0], &a[1], &a[2], &a[3], &a[4], &a[5]) == 6) {
+            // A headset that isn't paired yet never takes a paired one's
+            // place; with the table full of those, its section is skipped.
+            BtDeviceConfig* device = FindDevice(addr);
+
+            if (device == NULL)
+                device = AddDevice(addr, false);
+
+            tuning = device != NULL ? &device->tuning : NULL;
+        }
+        else if (tuning == NULL) {
+            continue;
+        }
+        else if (sscanf(line, " band = %15s %f %f %f", type, &band.freq_hz, &band.gain_db, &band.q) == 4) {
+            // %f takes "nan" and "inf" too, which every range check lets by.
+            if (tuning->num_bands == DSP_EQ_MAX_BANDS ||
+                !isfinite(band.freq_hz) || !isfinite(band.gain_db) || !isfinite(band.q))
+                continue;
+
+            for (auto& eq_type: g_eq_types) {
+                if (strcmp(type, eq_type.name) == 0) {
+                    band.type = eq_type.type;
+                    tuning->bands[tuning->num_bands++] = band;
+                }
             }
         }
+        else if (sscanf(line, " %31[^= \t] = %31s", key, value) == 2) {
+            u32 num = strtoul(value, NULL, 0);
 
-        m_btaddr = m_btsettings.addr;
-        fclose(fd);
+            if (strcmp(key, "ring_depth_ms") == 0) {
+                tuning->ring_depth_ms = Clamp(num, 0, TUNING_MAX_RING_DEPTH_MS);
+            }
+            else if (strcmp(key, "btdrv_latency_ms") == 0) {
+                tuning->btdrv_latency_ms = Clamp(num, TUNING_MIN_BTDRV_LATENCY_MS, TUNING_MAX_BTDRV_LATENCY_MS);
+            }
+            else if (strcmp(key, "channels") == 0) {
+                for (auto& channels: g_channel_routings) {
+                    if (strcmp(value, channels.name) == 0)
+                        tuning->channels = channels.routing;
+                }
+            }
+        }
     }
 
-    if (needs_update) {
-        SaveConfig();
+    fclose(fd);
+
+    for (u32 i = 0; i < num_loaded && i < m_num_devices; i++)
+        m_is_dirty = m_is_dirty || NE(loaded[i], m_devices[i].tuning);
+}
+
+Result BtConfig::LoadDevices()
+{
+    // Before any connect can schedule a write; the writer itself only starts
+    // with Initialize().
+    ueventCreate(&m_writethread_exitsignal, false);
+    ueventCreate(&m_write_signal, true);
+
+    mutexLock(&m_mutex);
+
+    // A save interrupted between its remove and its rename leaves only the
+    // temporary file, complete.
+    if (!ReadDevices("config/btred/devices.bin") && !ReadDevices("config/btred/devices.tmp")) {
+        m_num_devices = 0;
+        m_seq = 0;
+        m_btaddr = {};
+        MigrateSettings();
     }
 
+    LoadHeadsets();
+
+    mutexUnlock(&m_mutex);
     return 0;
 }
 
-void BtConfig::SaveConfig()
+Result BtConfig::Initialize()
+{
+    #define WriterStackSize 0x2000
+    // Lowest priority there is; file I/O must never compete with audio.
+    #define WriterPrio 0x3F
+    #define WriterCore -2
+    Result rc;
+
+    mutexLock(&m_mutex);
+
+    for (u32 i = 0; i < m_num_devices; i++) {
+        BtDeviceConfig& device = m_devices[i];
+        SetSysBluetoothDevicesSettings settings;
+
+        if (!device.is_paired)
+            continue;
+
+        rc = btdrvGetPairedDeviceInfo(device.addr, &settings);
+
+        if (R_SUCCEEDED(rc)) {
+            m_is_dirty = m_is_dirty || NE(device.settings, settings);
+            device.settings = settings;
+        }
+        else {
+            // Not worth losing audio over; it just has to pair again, and
+            // the next boot tries once more.
+            rc = btdrvAddPairedDeviceInfo(&device.settings);
+
+            if (R_FAILED(rc))
+                TRACE("[!] btdrvAddPairedDeviceInfo: 0x%x\n", rc);
+        }
+    }
+
+    mutexUnlock(&m_mutex);
+
+    m_writethread_stack = memalign(0x1000, WriterStackSize);
+
+    if (m_writethread_stack == NULL) {
+        return -1;
+    }
+
+    rc = threadCreate(
+        &m_writethread,
+        (ThreadFunc) WriterThreadTrampoline,
+        (void*) this,
+        m_writethread_stack,
+        WriterStackSize,
+        WriterPrio,
+        WriterCore);
+
+    if (R_FAILED(rc)) {
+        free(m_writethread_stack);
+        return rc;
+    }
+
+    rc = threadStart(&m_writethread);
+
+    if (R_FAILED(rc)) {
+        threadClose(&m_writethread);
+        free(m_writethread_stack);
+        return rc;
+    }
+
+    m_is_writer_initialized = true;
+    ScheduleWrite();
+    return rc;
+}
+
+void BtConfig::Finalize()
+{
+    if (m_is_writer_initialized) {
+        ueventSignal(&m_writethread_exitsignal);
+        threadWaitForExit(&m_writethread);
+        threadClose(&m_writethread);
+        free(m_writethread_stack);
+        m_is_writer_initialized = false;
+    }
+}
+
+static bool WriteDevices(const BtDeviceConfig* devices, u32 num_devices, BtdrvAddress last_addr)
 {
     mkdir("config", 0666);
     mkdir("config/btred", 0666);
 
-    FILE* fd = fopen("config/btred/settings.bin", "wb");
+    ConfigHeader header{};
+    ConfigRecord record;
+
+    header.magic = CONFIG_MAGIC;
+    header.version = CONFIG_VERSION;
+    header.header_size = sizeof(header);
+    header.record_size = sizeof(record);
+    header.num_records = num_devices;
+    header.last_addr = last_addr;
+
+    for (u32 i = 0; i < num_devices; i++) {
+        ToRecord(devices[i], &record);
+        header.crc = Crc32(header.crc, &record, sizeof(record));
+    }
+
+    // Write then rename, so that a power cut never leaves a torn file.
+    FILE* fd = fopen("config/btred/devices.tmp", "wb");
+
+    if (fd == NULL)
+        return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, fd) == 1;
+
+    for (u32 i = 0; ok && i < num_devices; i++) {
+        ToRecord(devices[i], &record);
+        ok = fwrite(&record, sizeof(record), 1, fd) == 1;
+    }
+
+    ok = fclose(fd) == 0 && ok;
 
-    if (fd != NULL) {
-        fwrite(&m_btsettings, sizeof(m_btsettings), 1, fd);
-        fclose(fd);
+    if (ok) {
+        remove("config/btred/devices.bin");
+        ok = rename("config/btred/devices.tmp", "config/btred/devices.bin") == 0;
     }
+
+    return ok;
 }
 
-void BtConfig::SetHeadphonesBtAddress(BtdrvAddress btaddr)
+void BtConfig::ScheduleWrite()
 {
-    bool dirty = NE(btaddr, m_btaddr);
+    ueventSignal(&m_write_signal);
+}
 
-    SetSysBluetoothDevicesSettings settings;
-    Result rc;
+// Re-reads the pairings of the headsets that connected since the last time,
+// then writes the table if that, or anything else, changed it. Only the
+// copies happen under the lock.
+void BtConfig::Flush()
+{
+    u64 start = armTicksToNs(svcGetSystemTick());
+    u32 num_refresh = 0;
 
-    rc = btdrvGetPairedDeviceInfo(btaddr, &settings);
+    mutexLock(&m_mutex);
 
-    if (R_SUCCEEDED(rc)) {
-        dirty = dirty || NE(m_btsettings, settings);
-        m_btsettings = settings;
+    for (u32 i = 0; i < m_num_devices; i++) {
+        if (m_devices[i].is_stale) {
+            m_devices[i].is_stale = false;
+            m_refresh_addrs[num_refresh++] = m_devices[i].addr;
+        }
+    }
+
+    mutexUnlock(&m_mutex);
+
+    bool is_refreshed[CONFIG_MAX_DEVICES];
+
+    for (u32 i = 0; i < num_refresh; i++)
+        is_refreshed[i] = R_SUCCEEDED(btdrvGetPairedDeviceInfo(m_refresh_addrs[i], &m_refresh_settings[i]));
+
+    mutexLock(&m_mutex);
+
+    for (u32 i = 0; i < num_refresh; i++) {
+        BtDeviceConfig* device = FindDevice(m_refresh_addrs[i]);
+
+        if (device == NULL || !is_refreshed[i])
+            continue;
+
+        if (!device->is_paired || NE(device->settings, m_refresh_settings[i])) {
+            device->is_paired = true;
+            device->settings = m_refresh_settings[i];
+            m_is_dirty = true;
+        }
+    }
+
+    bool is_dirty = m_is_dirty;
+    u32 num_devices = 0;
+    BtdrvAddress last_addr = m_btaddr;
+
+    // Headsets without a pairing, from headsets.ini alone, or whose pairing
+    // couldn't be read, are left out; the ini brings the former back.
+    for (u32 i = 0; is_dirty && i < m_num_devices; i++) {
+        if (m_devices[i].is_paired)
+            m_snapshot[num_devices++] = m_devices[i];
+    }
+
+    m_is_dirty = false;
+
+    mutexUnlock(&m_mutex);
+
+    if (is_dirty && !WriteDevices(m_snapshot, num_devices, last_addr)) {
+        // Tried again with the next change.
+        mutexLock(&m_mutex);
+        m_is_dirty = true;
+        mutexUnlock(&m_mutex);
+    }
+
+    if (num_refresh != 0 || is_dirty) {
+        u64 end = armTicksToNs(svcGetSystemTick());
+        g_telemetry.System().config_write.Record((end - start) / 1000);
+    }
+}
+
+void BtConfig::WriterThread()
+{
+    bool running = true;
+    Result rc = 0;
+
+    while (running)
+    {
+        int idx;
+
+        rc = waitMulti(
+            &idx, -1,
+            waiterForUEvent(&m_writethread_exitsignal),
+            waiterForUEvent(&m_write_signal));
+
+        if (R_FAILED(rc))
+            fatalThrow(rc);
+
+        // Whatever else changes meanwhile goes into the same write.
+        if (idx == 1) {
+            rc = waitMulti(&idx, CONFIG_WRITE_DELAY_NS, waiterForUEvent(&m_writethread_exitsignal));
+
+            if (R_FAILED(rc) && rc != KERNELRESULT(TimedOut))
+                fatalThrow(rc);
+
+            running = R_FAILED(rc);
+        }
+        else {
+            running = false;
+        }
+
+        Flush();
+    }
+}
+
+BtAudioTuning BtConfig::GetAudioTuning(BtdrvAddress addr)
+{
+    BtAudioTuning tuning = m_tuning;
+
+    mutexLock(&m_mutex);
+
+    BtDeviceConfig* device = FindDevice(addr);
+
+    if (device != NULL && device->tuning.ring_depth_ms != CONFIG_TUNING_UNSET)
+        tuning.ring_depth_ms = device->tuning.ring_depth_ms;
+
+    if (device != NULL && device->tuning.btdrv_latency_ms != CONFIG_TUNING_UNSET)
+        tuning.btdrv_latency_ms = device->tuning.btdrv_latency_ms;
+
+    mutexUnlock(&m_mutex);
+    return tuning;
+}
+
+BtDeviceTuning BtConfig::GetDeviceTuning(BtdrvAddress addr)
+{
+    mutexLock(&m_mutex);
+
+    BtDeviceConfig* device = FindDevice(addr);
+    BtDeviceTuning tuning = device != NULL ? device->tuning : g_default_device_tuning;
+
+    mutexUnlock(&m_mutex);
+    return tuning;
+}
+
+u32 BtConfig::GetMaxRingDepthMs()
+{
+    u32 depth = m_tuning.ring_depth_ms;
+
+    mutexLock(&m_mutex);
+
+    for (u32 i = 0; i < m_num_devices; i++) {
+        u32 device_depth = m_devices[i].tuning.ring_depth_ms;
+
+        if (device_depth != CONFIG_TUNING_UNSET && device_depth > depth)
+            depth = device_depth;
     }
 
-    if (dirty) {
-        SaveConfig();
+    mutexUnlock(&m_mutex);
+    return depth;
+}
+
+void BtConfig::SetHeadphonesBtAddress(BtdrvAddress btaddr)
+{
+    mutexLock(&m_mutex);
+
+    BtDeviceConfig* device = FindDevice(btaddr);
+
+    if (device == NULL)
+        device = AddDevice(btaddr, true);
+
+    device->is_stale = true;
+
+    if (NE(btaddr, m_btaddr)) {
+        m_btaddr = btaddr;
+        device->seq = ++m_seq;
+        m_is_dirty = true;
     }
+
+    mutexUnlock(&m_mutex);
+
+    ScheduleWrite();
 }
 
 BtdrvAddress BtConfig::GetHeadphonesBtAddress()
 {
-    return m_btaddr;
+    mutexLock(&m_mutex);
+    BtdrvAddress btaddr = m_btaddr;
+    mutexUnlock(&m_mutex);
+    return btaddr;
 }
 
 bool BtConfig::HasHeadphonesBtAddress()
 {
     BtdrvAddress empty{};
-    return NE(empty, m_btaddr);
-}
\ No newline at end of file
+    BtdrvAddress btaddr = GetHeadphonesBtAddress();
+    return NE(empty, btaddr);
+}
@@ -1,18 +1,142 @@
 #pragma once
 
+#include "bt_dsp.h"
+
+// Audio pipeline tuning, read from config/btred/tuning.ini. Trades latency
+// against robustness without rebuilding the sysmodule.
+struct BtAudioTuning {
+    u32 num_buffers;        // audrec buffers in flight
+    u32 period_samples;     // interleaved s16 samples per buffer
+    u32 btdrv_latency_ms;   // latency requested from btdrvStartAudioOut
+    u32 ring_depth_ms;      // capture -> send ring depth
+    u32 sample_rate;        // offered to audio outs first, see below
+    u32 drift_ppm;          // largest clock drift corrected, 0 = off
+    DspRouting channels;    // what each ear gets, applied after the volume
+    u32 limiter_ceiling_db; // peak limit below full scale, 0 = off
+    u32 idle_after_ms;      // of silence, until sends pause, 0 = never
+};
+
+#define TUNING_MIN_BUFFERS 2
+#define TUNING_MAX_BUFFERS 16
+#define TUNING_MIN_PERIOD_SAMPLES 0x100
+#define TUNING_MAX_PERIOD_SAMPLES 0x1000
+#define TUNING_MIN_BTDRV_LATENCY_MS 1
+#define TUNING_MAX_BTDRV_LATENCY_MS 100
+#define TUNING_MAX_RING_DEPTH_MS 500
+#define TUNING_MAX_DRIFT_PPM 1000
+#define TUNING_MAX_LIMITER_CEILING_DB 24
+#define TUNING_MAX_IDLE_AFTER_MS 60000
+
+// Rates an audio out can be started at. Anything but the capture rate is
+// resampled per device; a headset that refuses it gets the capture rate.
+#define TUNING_SAMPLE_RATES { 48000, 44100, 32000, 16000 }
+
+// What btred remembers of each headset, in config/btred/devices.bin: its
+// pairing, restored to btdrv at boot, and its own tuning, set in
+// config/btred/headsets.ini:
+//
+//   [00:11:22:33:44:55]
+//   channels = mono
+//   ring_depth_ms = 96
+//   btdrv_latency_ms = 10
+//   band = <type> <freq_hz> <gain_db> <q>
+//
+// with up to DSP_EQ_MAX_BANDS bands per headset, applied in order. Keys left
+// out follow tuning.ini.
+#define CONFIG_TUNING_UNSET 0xFFFFFFFF
+
+struct BtDeviceTuning {
+    u32 ring_depth_ms;      // or CONFIG_TUNING_UNSET
+    u32 btdrv_latency_ms;   // likewise
+    DspRouting channels;    // on top of tuning.ini's, stereo = as captured
+    u32 num_bands;
+    DspEqBand bands[DSP_EQ_MAX_BANDS];
+};
+
+struct BtDeviceConfig {
+    BtdrvAddress addr;
+    bool is_paired;         // settings came from btdrv
+    bool is_stale;          // settings to be re-read by the writer
+    u32 seq;                // when it was last the headset, for eviction
+    SetSysBluetoothDevicesSettings settings;
+    BtDeviceTuning tuning;
+};
+
+#define CONFIG_MAX_DEVICES 16
+
+// Changes are written back by a low-priority writer thread, never on the
+// thread that made them, a while after the first one, so that a burst of
+// connects costs one write.
+#define CONFIG_WRITE_DELAY_NS 500000000ULL
+
 class BtConfig {
 public:
     BtConfig();
+    ~BtConfig();
+
+    // Reads devices.bin, or migrates settings.bin, and applies headsets.ini;
+    // once, at boot, before anything asks for a headset's tuning.
+    Result LoadDevices();
+
+    // Restores the pairings btdrv lost, and picks up the ones it changed,
+    // then starts the writer. Changes made before are written then.
     Result Initialize();
-    void SaveConfig();
 
+    // Writes back what is still pending.
+    void   Finalize();
+
+    Result LoadTuning();
+    const BtAudioTuning& GetAudioTuning() { return m_tuning; }
+
+    // tuning.ini's, with the headset's own on top. The ring depth is never
+    // more than GetMaxRingDepthMs(), which rings are sized for.
+    BtAudioTuning GetAudioTuning(BtdrvAddress addr);
+    BtDeviceTuning GetDeviceTuning(BtdrvAddress addr);
+    u32 GetMaxRingDepthMs();
+
+    // Called on every connect; only touches the table. The headset's
+    // pairing is re-read from btdrv, and the file written if anything
+    // changed, by the writer.
     bool HasHeadphonesBtAddress();
     void SetHeadphonesBtAddress(BtdrvAddress btaddr);
     BtdrvAddress GetHeadphonesBtAddress();
 
 private:
-    SetSysBluetoothDevicesSettings m_btsettings;
+    // Writer thread only. Written only if something changed since the last
+    // save.
+    void Flush();
+    void ScheduleWrite();
+    BtDeviceConfig* FindDevice(BtdrvAddress addr);
+    BtDeviceConfig* AddDevice(BtdrvAddress addr, bool can_evict_paired);
+    bool ReadDevices(const char* path);
+    bool MigrateSettings();
+    void LoadHeadsets();
+
+    Mutex m_mutex;
     BtdrvAddress m_btaddr;
+    BtAudioTuning m_tuning;
+    BtDeviceConfig m_devices[CONFIG_MAX_DEVICES];
+    u32 m_num_devices;
+    u32 m_seq;
+    bool m_is_dirty;
+
+    // Writer thread only: the headsets being re-read, and a copy of the
+    // table, so that neither btdrv nor the SD card is waited on under
+    // m_mutex.
+    BtdrvAddress m_refresh_addrs[CONFIG_MAX_DEVICES];
+    SetSysBluetoothDevicesSettings m_refresh_settings[CONFIG_MAX_DEVICES];
+    BtDeviceConfig m_snapshot[CONFIG_MAX_DEVICES];
+
+    static void WriterThreadTrampoline(BtConfig* self) {
+        self->WriterThread();
+    }
+    void WriterThread();
+
+    bool   m_is_writer_initialized;
+    Thread m_writethread;
+    void*  m_writethread_stack;
+    UEvent m_writethread_exitsignal;
+    UEvent m_write_signal;
 };
 
 extern BtConfig g_config;
\ No newline at end of file
@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <malloc.h>
+#include <new>
+#include <switch.h>
+#include "bt_capture.h"
+#include "bt_config.h"
+#include "bt_device_pool.h"
+
+BtDevicePool g_device_pool;
+
+
+BtDevicePool::BtDevicePool():
+    m_is_initialized(false),
+    m_stack_mem(NULL),
+    m_ring_mem(NULL),
+    m_resample_filter{},
+    m_drift_filter{},
+    m_filter_mem(NULL),
+    m_resample_mem(NULL),
+    m_eq_mem(NULL),
+    m_capture_mem(NULL),
+    m_capture_pool(NULL),
+    m_capture_stack(NULL)
+{
+    mutexInit(&m_mutex);
+
+    for (auto& slot: m_slots)
+        slot.is_used = false;
+}
+
+BtDevicePool::~BtDevicePool()
+{
+    Finalize();
+}
+
+Result BtDevicePool::Initialize()
+{
+    BtAudioTuning tuning = g_config.GetAudioTuning();
+    BtAudioFormat format = AUDIO_FORMAT_CAPTURE;
+    tuning.ring_depth_ms = g_config.GetMaxRingDepthMs();
+    size_t ring_periods = BtCapture::RingPeriods(tuning, format);
+    size_t resample_size = 0;
+    size_t period_bytes = format.ToBytes(format.ToFrames(AudioSamples{tuning.period_samples})).count;
+    size_t eq_size = period_bytes;
+
+    // The slowest device holds at most a full ring, plus the period it is
+    // sending; one more is being filled.
+    size_t pool_periods = ring_periods + 2;
+
+    m_stack_mem = memalign(0x1000, DEVICE_POOL_SIZE * SEND_STACK_SIZE);
+
+    if (m_stack_mem == NULL)
+        return -1;
+
+    m_ring_mem = (BtPcmPeriod**) calloc(DEVICE_POOL_SIZE * ring_periods, sizeof(BtPcmPeriod*));
+
+    if (m_ring_mem == NULL) {
+        free(m_stack_mem);
+        m_stack_mem = NULL;
+        return -1;
+    }
+
+    Result rc = InitializeFilters(tuning, format, &resample_size);
+
+    if (R_SUCCEEDED(rc) && resample_size != 0) {
+        m_resample_mem = memalign(0x10, DEVICE_POOL_SIZE * resample_size);
+
+        if (m_resample_mem == NULL)
+            rc = -1;
+    }
+
+    if (R_SUCCEEDED(rc)) {
+        m_eq_mem = (s16*) memalign(0x10, DEVICE_POOL_SIZE * eq_size);
+
+        if (m_eq_mem == NULL)
+            rc = -1;
+    }
+
+    if (R_SUCCEEDED(rc)) {
+        m_capture_mem = memalign(0x1000, (tuning.num_buffers + pool_periods) * period_bytes);
+        m_capture_pool = (BtPcmPeriod*) calloc(pool_periods, sizeof(BtPcmPeriod));
+        m_capture_stack = memalign(0x1000, CAPTURE_STACK_SIZE);
+
+        if (m_capture_mem == NULL || m_capture_pool == NULL || m_capture_stack == NULL)
+            rc = -1;
+    }
+
+    if (R_FAILED(rc)) {
+        free(m_capture_stack);
+        free(m_capture_pool);
+        free(m_capture_mem);
+        free(m_eq_mem);
+        free(m_resample_mem);
+        free(m_filter_mem);
+        free(m_ring_mem);
+        free(m_stack_mem);
+        m_capture_stack = NULL;
+        m_capture_pool = NULL;
+        m_capture_mem = NULL;
+        m_eq_mem = NULL;
+        m_resample_mem = NULL;
+        m_filter_mem = NULL;
+        m_ring_mem = NULL;
+        m_stack_mem = NULL;
+        return rc;
+    }
+
+    // audrec's buffers first, then the pool's samples.
+    u8* capture_samples = (u8*) m_capture_mem + tuning.num_buffers * period_bytes;
+
+    for (size_t i = 0; i < pool_periods; i++)
+        m_capture_pool[i].samples = (s16*)(capture_samples + i * period_bytes);
+
+    g_capture.SetResources(BtCaptureResources{
+        .buffer_mem = m_capture_mem,
+        .pool = m_capture_pool,
+        .pool_size = pool_periods,
+        .thread_stack = m_capture_stack,
+    });
+
+    for (size_t i = 0; i < DEVICE_POOL_SIZE; i++) {
+        m_slots[i].resources.send_thread = &m_slots[i].send_thread;
+        m_slots[i].resources.send_stack = (u8*) m_stack_mem + i * SEND_STACK_SIZE;
+        m_slots[i].resources.ring_slots = m_ring_mem + i * ring_periods;
+        m_slots[i].resources.ring_periods = ring_periods;
+        m_slots[i].resources.resample_filter = m_resample_filter.taps != 0 ? &m_resample_filter : NULL;
+        m_slots[i].resources.drift_filter = m_drift_filter.taps != 0 ? &m_drift_filter : NULL;
+        m_slots[i].resources.resample_mem = m_resample_mem != NULL ? (u8*) m_resample_mem + i * resample_size : NULL;
+        m_slots[i].resources.eq_mem = (s16*)((u8*) m_eq_mem + i * eq_size);
+    }
+
+    m_is_initialized = true;
+    return 0;
+}
+
+Result BtDevicePool::InitializeFilters(const BtAudioTuning& tuning, const BtAudioFormat& format, size_t* slot_size)
+{
+    AudioFrames period = format.ToFrames(AudioSamples{tuning.period_samples});
+    u32 rate = format.sample_rate;
+
+    // Converting to the tuned rate, and, if drift is corrected, following the
+    // headset at the capture rate.
+    u32 resample_taps = tuning.sample_rate != rate ? DspResampleTaps(rate, tuning.sample_rate) : 0;
+    u32 drift_taps = tuning.drift_ppm != 0 ? DspResampleTaps(rate, rate) : 0;
+    size_t resample_entries = resample_taps != 0 ? DspResampleFilterSize(resample_taps) : 0;
+    size_t drift_entries = drift_taps != 0 ? DspResampleFilterSize(drift_taps) : 0;
+
+    m_resample_filter = {};
+    m_drift_filter = {};
+    *slot_size = 0;
+
+    if (resample_entries + drift_entries == 0)
+        return 0;
+
+    m_filter_mem = (s16*) memalign(0x10, (resample_entries + drift_entries) * sizeof(s16));
+
+    if (m_filter_mem == NULL)
+        return -1;
+
+    size_t size = 0;
+
+    if (resample_taps != 0) {
+        DspResampleFilterInit(&m_resample_filter, m_filter_mem, resample_taps, rate, tuning.sample_rate);
+        size = BtResampler::MemSize(&m_resample_filter, period, rate, tuning.sample_rate);
+    }
+
+    if (drift_taps != 0) {
+        DspResampleFilterInit(&m_drift_filter, m_filter_mem + resample_entries, drift_taps, rate, rate);
+        size_t drift_size = BtResampler::MemSize(&m_drift_filter, period, rate, rate);
+        size = drift_size > size ? drift_size : size;
+    }
+
+    *slot_size = (size + 0xF) & ~0xF;
+    return 0;
+}
+
+void BtDevicePool::Finalize()
+{
+    if (m_is_initialized) {
+        for (auto& slot: m_slots)
+            slot.send_thread.Finalize();
+
+        g_capture.ClearResources();
+
+        free(m_capture_stack);
+        free(m_capture_pool);
+        free(m_capture_mem);
+        free(m_eq_mem);
+        free(m_resample_mem);
+        free(m_filter_mem);
+        free(m_ring_mem);
+        free(m_stack_mem);
+        m_capture_stack = NULL;
+        m_capture_pool = NULL;
+        m_capture_mem = NULL;
+        m_eq_mem = NULL;
+        m_resample_mem = NULL;
+        m_filter_mem = NULL;
+        m_ring_mem = NULL;
+        m_stack_mem = NULL;
+        m_is_initialized = false;
+    }
+}
+
+BtAudioDevice* BtDevicePool::Acquire(BtdrvAddress addr)
+{
+    BtAudioDevice* device = NULL;
+
+    if (!m_is_initialized)
+        return NULL;
+
+    mutexLock(&m_mutex);
+
+    for (auto& slot: m_slots) {
+        if (!slot.is_used) {
+            slot.is_used = true;
+            device = new (slot.storage) BtAudioDevice(addr, slot.resources);
+            break;
+        }
+    }
+
+    mutexUnlock(&m_mutex);
+    return device;
+}
+
+void BtDevicePool::Release(BtAudioDevice* device)
+{
+    // Tear down outside the lock; the destructor waits on btdrv and audrec.
+    device->~BtAudioDevice();
+
+    mutexLock(&m_mutex);
+
+    for (auto& slot: m_slots) {
+        if ((void*) slot.storage == (void*) device) {
+            slot.is_used = false;
+            break;
+        }
+    }
+
+    mutexUnlock(&m_mutex);
+}
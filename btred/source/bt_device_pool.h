@@ -0,0 +1,65 @@
+#pragma once
+
+#include "bt_audio_device.h"
+
+// btdrvGetConnectedAudioDevice reports at most this many.
+#define DEVICE_POOL_SIZE 8
+
+// Fixed slots for BtAudioDevice, with their send stacks, ring storage,
+// resampler and EQ buffers reserved once at boot, along with the capture's
+// audrec buffers, period pool and thread stack. Connecting and
+// disconnecting then doesn't touch the heap at all, so it can't fragment it,
+// and can't fail on it either. Each slot's send thread is kept too, once
+// started, and serves every device that lands in the slot.
+//
+// Acquire() comes from the manager thread, Release() from the device worker.
+class BtDevicePool {
+public:
+    BtDevicePool();
+    ~BtDevicePool();
+
+    // After g_config.LoadTuning() and LoadDevices(), and before the first
+    // device attaches to g_capture; ring and pool sizes derive from the
+    // tuning, and the deepest ring a headset asks for.
+    Result Initialize();
+    void   Finalize();
+
+    // NULL if all slots are taken.
+    BtAudioDevice* Acquire(BtdrvAddress addr);
+    void Release(BtAudioDevice* device);
+
+private:
+    // Sets the resampler memory a slot needs; 0 if the tuning needs no
+    // filter.
+    Result InitializeFilters(const BtAudioTuning& tuning, const BtAudioFormat& format, size_t* slot_size);
+
+    struct Slot {
+        alignas(BtAudioDevice) u8 storage[sizeof(BtAudioDevice)];
+        BtDeviceResources resources;
+        BtParkedThread send_thread;
+        bool is_used;
+    };
+
+    Mutex  m_mutex;
+    bool   m_is_initialized;
+    void*  m_stack_mem;
+    BtPcmPeriod** m_ring_mem;
+
+    // Shared by all slots, and only built if the tuning asks for a rate
+    // other than the capture's, or for drift correction. Unused ones have no
+    // taps.
+    DspResampleFilter m_resample_filter;
+    DspResampleFilter m_drift_filter;
+    s16*   m_filter_mem;
+    void*  m_resample_mem;
+    s16*   m_eq_mem;       // a period per slot, whether or not any headset needs it
+
+    // Handed to g_capture.
+    void*  m_capture_mem;
+    BtPcmPeriod* m_capture_pool;
+    void*  m_capture_stack;
+
+    Slot   m_slots[DEVICE_POOL_SIZE];
+};
+
+extern BtDevicePool g_device_pool;
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <switch.h>
+#include "bt_device_pool.h"
+#include "bt_device_worker.h"
+#include "bt_telemetry.h"
+
+//#define ENABLE_TRACE
+
+#ifdef ENABLE_TRACE
+#define TRACE(...) printf(__VA_ARGS__)
+#else
+#define TRACE(...)
+#endif
+
+
+BtDeviceWorker::BtDeviceWorker():
+    m_is_initialized(false),
+    m_num_requests(0),
+    m_num_connecting(0)
+{
+    mutexInit(&m_mutex);
+}
+
+BtDeviceWorker::~BtDeviceWorker()
+{
+    Finalize();
+}
+
+Result BtDeviceWorker::Initialize()
+{
+    #define WorkerStackSize 0x4000
+    // Same as the manager thread; bring-up isn't more urgent than noticing
+    // a disconnect.
+    #define WorkerPrio 0x30
+    #define WorkerCore -2
+    Result rc;
+
+    m_workthread_stack = memalign(0x1000, WorkerStackSize);
+
+    if (m_workthread_stack == NULL) {
+        return -1;
+    }
+
+    rc = threadCreate(
+        &m_workthread,
+        (ThreadFunc) WorkerThreadTrampoline,
+        (void*) this,
+        m_workthread_stack,
+        WorkerStackSize,
+        WorkerPrio,
+        WorkerCore);
+
+    if (R_FAILED(rc)) {
+        free(m_workthread_stack);
+        return rc;
+    }
+
+    ueventCreate(&m_workthread_exitsignal, false);
+    ueventCreate(&m_wake, true);
+    ueventCreate(&m_done, true);
+    ueventCreate(&m_idle, false);
+
+    rc = threadStart(&m_workthread);
+
+    if (R_FAILED(rc)) {
+        threadClose(&m_workthread);
+        free(m_workthread_stack);
+        return rc;
+    }
+
+    m_is_initialized = true;
+    return rc;
+}
+
+void BtDeviceWorker::Finalize()
+{
+    if (m_is_initialized) {
+        ueventSignal(&m_workthread_exitsignal);
+        threadWaitForExit(&m_workthread);
+        threadClose(&m_workthread);
+        free(m_workthread_stack);
+        m_is_initialized = false;
+    }
+}
+
+void BtDeviceWorker::Start(BtAudioDevice* device)
+{
+    Queue(true, device);
+}
+
+void BtDeviceWorker::Stop(BtAudioDevice* device)
+{
+    Queue(false, device);
+}
+
+void BtDeviceWorker::Queue(bool is_start, BtAudioDevice* device)
+{
+    mutexLock(&m_mutex);
+    m_requests[m_num_requests++] = Request{is_start, device};
+    mutexUnlock(&m_mutex);
+
+    ueventSignal(&m_wake);
+}
+
+void BtDeviceWorker::WaitIdle()
+{
+    int idx;
+
+    // The worker checks for idle under m_mutex, after handling requests, so
+    // it can't report idle for a state older than this.
+    mutexLock(&m_mutex);
+    ueventClear(&m_idle);
+    mutexUnlock(&m_mutex);
+
+    ueventSignal(&m_wake);
+    waitMulti(&idx, -1, waiterForUEvent(&m_idle));
+}
+
+void BtDeviceWorker::HandleRequests()
+{
+    Request requests[WORKER_MAX_REQUESTS];
+    size_t num_requests;
+
+    mutexLock(&m_mutex);
+    num_requests = m_num_requests;
+    memcpy(requests, m_requests, num_requests * sizeof(Request));
+    m_num_requests = 0;
+    mutexUnlock(&m_mutex);
+
+    for (size_t i = 0; i < num_requests; i++) {
+        BtAudioDevice* device = requests[i].device;
+
+        if (requests[i].is_start) {
+            if (R_SUCCEEDED(device->Open())) {
+                m_connecting[m_num_connecting++] = device;
+
+                // No event comes for an audio out that is ready already.
+                if (device->IsReady())
+                    StartDevice(m_num_connecting - 1);
+            }
+            else {
+                ueventSignal(&m_done);
+            }
+        }
+        else {
+            // Dropped before it came up.
+            for (size_t j = 0; j < m_num_connecting; j++) {
+                if (m_connecting[j] == device) {
+                    RemoveConnecting(j);
+                    break;
+                }
+            }
+
+            g_device_pool.Release(device);
+        }
+    }
+}
+
+void BtDeviceWorker::RemoveConnecting(size_t idx)
+{
+    m_connecting[idx] = m_connecting[--m_num_connecting];
+}
+
+void BtDeviceWorker::StartDevice(size_t idx)
+{
+    BtAudioDevice* device = m_connecting[idx];
+    RemoveConnecting(idx);
+
+    device->Start();
+    ueventSignal(&m_done);
+
+    // A first device also brings up the capture buffers.
+    g_telemetry.SampleHeap();
+}
+
+void BtDeviceWorker::StartOverdue()
+{
+    u64 now = armTicksToNs(svcGetSystemTick());
+
+    for (size_t i = 0; i < m_num_connecting; ) {
+        if (now >= m_connecting[i]->GetReadyDeadline()) {
+            TRACE("[!] audio out not ready, starting anyway\n");
+            StartDevice(i);
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+void BtDeviceWorker::WorkerThread()
+{
+    bool running = true;
+    Result rc = 0;
+
+    while (running)
+    {
+        Waiter waiters[2 + DEVICE_POOL_SIZE];
+        s32 num_waiters = 0;
+        u64 timeout = UINT64_MAX;
+        u64 now = armTicksToNs(svcGetSystemTick());
+        s32 idx;
+
+        waiters[num_waiters++] = waiterForUEvent(&m_workthread_exitsignal);
+        waiters[num_waiters++] = waiterForUEvent(&m_wake);
+
+        // Each device starts once its state event shows it ready, or at its
+        // deadline, whichever comes first.
+        for (size_t i = 0; i < m_num_connecting; i++) {
+            u64 deadline = m_connecting[i]->GetReadyDeadline();
+            u64 left = deadline > now ? deadline - now : 0;
+
+            waiters[num_waiters++] = waiterForEvent(m_connecting[i]->GetReadyEvent());
+            timeout = left < timeout ? left : timeout;
+        }
+
+        rc = waitObjects(&idx, waiters, num_waiters, timeout);
+
+        if (rc == KERNELRESULT(TimedOut)) {
+            StartOverdue();
+        }
+        else if (R_FAILED(rc)) {
+            fatalThrow(rc);
+        }
+        else if (idx == 0) {
+            running = false;
+        }
+        else if (idx == 1) {
+            HandleRequests();
+        }
+        else if (m_connecting[idx - 2]->IsReady()) {
+            StartDevice(idx - 2);
+        }
+
+        mutexLock(&m_mutex);
+
+        if (m_num_requests == 0 && m_num_connecting == 0)
+            ueventSignal(&m_idle);
+
+        mutexUnlock(&m_mutex);
+    }
+}
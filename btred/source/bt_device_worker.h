@@ -0,0 +1,68 @@
+#pragma once
+
+#include "bt_audio_device.h"
+#include "bt_device_pool.h"
+
+// Brings devices up and tears them down off the manager thread, so that the
+// manager keeps handling connection events and timers meanwhile. Devices
+// waiting for their audio out to become ready are all waited on at once, so
+// a second headset doesn't queue behind the first one's bring-up.
+//
+// Devices are only ever released to g_device_pool here: the manager hands a
+// device over with Stop() when it drops it, and must not touch it after.
+class BtDeviceWorker {
+public:
+    BtDeviceWorker();
+    ~BtDeviceWorker();
+
+    Result Initialize();
+    void   Finalize();
+
+    void Start(BtAudioDevice* device);
+    void Stop(BtAudioDevice* device);
+
+    // Returns once everything queued so far, and every device still waiting
+    // to become ready, has been dealt with.
+    void WaitIdle();
+
+    // Signaled whenever a device reached Streaming or Stopped.
+    UEvent* GetDoneEvent() { return &m_done; }
+
+private:
+    void Queue(bool is_start, BtAudioDevice* device);
+    void HandleRequests();
+    void RemoveConnecting(size_t idx);
+    void StartDevice(size_t idx);
+    void StartOverdue();
+
+    static void WorkerThreadTrampoline(BtDeviceWorker* self) {
+        self->WorkerThread();
+    }
+    void WorkerThread();
+
+private:
+    // Each pooled device is started and stopped at most once, so this can
+    // never fill up.
+    #define WORKER_MAX_REQUESTS (2 * DEVICE_POOL_SIZE)
+
+    struct Request {
+        bool is_start;
+        BtAudioDevice* device;
+    };
+
+    bool   m_is_initialized;
+    Thread m_workthread;
+    void*  m_workthread_stack;
+    UEvent m_workthread_exitsignal;
+    UEvent m_wake;
+    UEvent m_done;
+    UEvent m_idle;
+
+    Mutex  m_mutex;
+    Request m_requests[WORKER_MAX_REQUESTS];    // under m_mutex
+    size_t m_num_requests;
+
+    // Opened, waiting for the audio out to become ready. Worker thread only.
+    BtAudioDevice* m_connecting[DEVICE_POOL_SIZE];
+    size_t m_num_connecting;
+};
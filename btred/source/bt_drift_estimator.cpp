@@ -0,0 +1,99 @@
+#include <switch.h>
+#include "bt_drift_estimator.h"
+
+// Send jitter is hundreds of microseconds per period, drift a few per
+// second: smooth over a second, and only steer once the delay settled.
+#define DRIFT_SMOOTHING_S 1.0
+#define DRIFT_SETTLE_NS 2000000000ULL
+
+// Gains, per microsecond of delay error. The loop then has a natural period
+// of about a minute and is critically damped, which is slow enough to never
+// be heard, and fast enough for a clock that wanders with temperature.
+#define DRIFT_KP 0.2        // ppm
+#define DRIFT_KI 0.01       // ppm per second
+
+// A gap this long is a stall or a re-prebuffer, not drift.
+#define DRIFT_MAX_GAP_NS 1000000000ULL
+
+static double Clamp(double v, double limit)
+{
+    return v > limit ? limit : v < -limit ? -limit : v;
+}
+
+BtDriftEstimator::BtDriftEstimator():
+    m_max_ppm(0),
+    m_max_error_us(0),
+    m_start_ns(0),
+    m_last_ns(0),
+    m_delay_us(0),
+    m_target_us(0),
+    m_is_settled(false),
+    m_step_sign(0),
+    m_drift_ppm(0),
+    m_correction_ppm(0)
+{ }
+
+void BtDriftEstimator::Initialize(u32 max_ppm, u64 period_ns)
+{
+    m_max_ppm = max_ppm;
+    m_max_error_us = period_ns / 2000.0;
+    m_start_ns = 0;
+    m_last_ns = 0;
+    m_delay_us = 0;
+    m_target_us = 0;
+    m_is_settled = false;
+    m_step_sign = 0;
+    m_drift_ppm = 0;
+    m_correction_ppm = 0;
+}
+
+void BtDriftEstimator::Update(u64 release_ns, u64 sent_ns)
+{
+    double delay_us = (sent_ns - release_ns) / 1000.0;
+
+    if (m_start_ns == 0) {
+        m_start_ns = sent_ns;
+        m_last_ns = sent_ns;
+        m_delay_us = delay_us;
+        return;
+    }
+
+    u64 dt_ns = sent_ns - m_last_ns;
+    m_last_ns = sent_ns;
+
+    if (dt_ns > DRIFT_MAX_GAP_NS)
+        return;
+
+    double dt = dt_ns / 1e9;
+    double alpha = dt < DRIFT_SMOOTHING_S ? dt / DRIFT_SMOOTHING_S : 1.0;
+    m_delay_us += alpha * (delay_us - m_delay_us);
+
+    if (!m_is_settled) {
+        if (sent_ns - m_start_ns < DRIFT_SETTLE_NS)
+            return;
+
+        m_target_us = m_delay_us;
+        m_is_settled = true;
+    }
+
+    double error_us = m_delay_us - m_target_us;
+
+    // Drift moves the delay slowly enough that the loop keeps it within a
+    // few milliseconds. Half a period off, the queue jumped instead, after a
+    // stall or a burst from audrec: only the proportional term drains that,
+    // all the way back to the target, so that the estimate doesn't wind up
+    // on it.
+    if (error_us > m_max_error_us || error_us < -m_max_error_us)
+        m_step_sign = error_us > 0 ? 1 : -1;
+    else if (m_step_sign * error_us <= 0)
+        m_step_sign = 0;
+
+    // Nor while the correction is already as large as it gets.
+    double correction = m_drift_ppm + DRIFT_KP * error_us;
+    bool is_saturated = correction * error_us > 0 && (correction > m_max_ppm || correction < -m_max_ppm);
+
+    if (m_step_sign == 0 && !is_saturated)
+        m_drift_ppm = Clamp(m_drift_ppm + DRIFT_KI * error_us * dt, m_max_ppm);
+
+    m_correction_ppm = (s32) Clamp(correction, m_max_ppm);
+}
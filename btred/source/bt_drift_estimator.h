@@ -0,0 +1,42 @@
+#pragma once
+
+// Keeps one device's queue where it settled, against the headset's clock.
+//
+// The queue is everything between audrec releasing a period and btdrv taking
+// the last of it. audrec runs on the console's audio clock, the headset on
+// its own: one that runs slow pushes back, and the queue grows, one that runs
+// fast drains it. Either way, the capture-to-send delay walks away from where
+// it settled, by one microsecond per second for every ppm, until a period is
+// dropped or the headset runs dry.
+//
+// The smoothed delay drives a PI controller whose output is a rate
+// correction for the device's resampler. Its integral term converges to the
+// clock offset itself, which is the drift estimate; the proportional term
+// pulls the delay back once it's off.
+class BtDriftEstimator {
+public:
+    BtDriftEstimator();
+
+    // max_ppm bounds both the estimate and the correction.
+    void Initialize(u32 max_ppm, u64 period_ns);
+
+    // Once per period, when btdrv has taken it. The first DRIFT_SETTLE_NS
+    // only find the target.
+    void Update(u64 release_ns, u64 sent_ns);
+
+    // Positive: consume input faster than nominal, to shrink the queue.
+    s32 GetCorrectionPpm() const { return m_correction_ppm; }
+    s32 GetDriftPpm() const { return (s32) m_drift_ppm; }
+
+private:
+    double m_max_ppm;
+    double m_max_error_us;  // beyond it, the queue jumped
+    u64    m_start_ns;
+    u64    m_last_ns;
+    double m_delay_us;      // smoothed
+    double m_target_us;
+    bool   m_is_settled;
+    int    m_step_sign;     // draining a jump in the queue, above or below
+    double m_drift_ppm;     // integral term
+    s32    m_correction_ppm;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "bt_histogram.h"
+
+// Serializes the btdrv control path: connections, and opening, starting and
+// stopping audio outs, all share g_btdrv_control_lock.
+//
+// Sends are not under it. A handle's sends and state queries only ever come
+// from its device's send thread, which starts after the handle was opened
+// and started, and is joined before it is stopped and closed
+// (BtAudioDevice::Start() and the destructor), so nothing else touches that
+// handle meanwhile. What does overlap is a send on one handle with control
+// calls on others; libnx builds every request in the calling thread's own
+// IPC buffer, and the service answers one request on a session at a time,
+// so those never interleave either. Sends on different headsets never wait
+// on each other, or on a reconnect.
+//
+// Lock() tries first without blocking, so that contention is cheap to count.
+// How long contended acquisitions waited is recorded, in microseconds, while
+// holding the lock, so the histogram has a single writer at a time.
+class BtDriverLock {
+public:
+    BtDriverLock() {
+        mutexInit(&m_mutex);
+    }
+
+    void Lock() {
+        if (mutexTryLock(&m_mutex))
+            return;
+
+        u64 start = armTicksToNs(svcGetSystemTick());
+        mutexLock(&m_mutex);
+        m_waits.Record((armTicksToNs(svcGetSystemTick()) - start) / 1000);
+    }
+
+    void Unlock() {
+        mutexUnlock(&m_mutex);
+    }
+
+    BtHistogram& GetWaits() { return m_waits; }
+
+private:
+    Mutex m_mutex;
+    BtHistogram m_waits;
+};
+
+extern BtDriverLock g_btdrv_control_lock;
@@ -0,0 +1,622 @@
+#include <math.h>
+#include <switch.h>
+#include <arm_neon.h>
+#include "bt_dsp.h"
+
+// Strict C++ leaves M_PI out of newlib's math.h.
+#define DSP_PI 3.14159265358979323846
+
+static inline s16 SatS16(s32 x)
+{
+    return x > 32767 ? 32767 : x < -32768 ? -32768 : (s16)x;
+}
+
+// Scalar model of SQRDMULH.
+static inline s16 MulQ15(s16 x, s16 gain)
+{
+    return SatS16((2 * (s32)x * gain + (1 << 15)) >> 16);
+}
+
+// The ramp is tracked per stereo frame in Q15.16, so that it is exact in
+// 32 bits for any pair of non-negative Q15 gains.
+static inline s32 RampStep(s16 from, s16 to, size_t frames)
+{
+    return ((s32)(to - from) * 65536) / (s32)frames;
+}
+
+s16 DspGainToQ15(float gain)
+{
+    long q = lrintf(gain * 32768.0f);
+
+    if (q > DSP_Q15_ONE)
+        q = DSP_Q15_ONE;
+
+    if (q < 0)
+        q = 0;
+
+    return (s16)q;
+}
+
+void DspApplyGainQ15Scalar(s16* dst, const s16* src, size_t samples, s16 gain)
+{
+    size_t i;
+    for (i=0; i<samples; i++) {
+        dst[i] = MulQ15(src[i], gain);
+    }
+}
+
+void DspApplyGainQ15(s16* dst, const s16* src, size_t samples, s16 gain)
+{
+    int16x8_t g = vdupq_n_s16(gain);
+
+    size_t i;
+    for (i=0; i<samples; i+=16) {
+        int16x8_t x0 = vld1q_s16(src + i);     // Load 16 s16.
+        int16x8_t x1 = vld1q_s16(src + i + 8);
+        x0 = vqrdmulhq_s16(x0, g);             // Rounding Q15 multiply (saturated!).
+        x1 = vqrdmulhq_s16(x1, g);
+        vst1q_s16(dst + i, x0);                // Store them.
+        vst1q_s16(dst + i + 8, x1);
+    }
+}
+
+void DspApplyGainQ15RampScalar(s16* dst, const s16* src, size_t samples, s16 from, s16 to)
+{
+    size_t frames = samples / 2;
+    s32 step = RampStep(from, to, frames);
+
+    size_t i;
+    for (i=0; i<frames; i++) {
+        s16 gain = (s16)(((s32)from * 65536 + step * (s32)i) >> 16);
+        dst[2*i + 0] = MulQ15(src[2*i + 0], gain);
+        dst[2*i + 1] = MulQ15(src[2*i + 1], gain);
+    }
+}
+
+void DspApplyGainQ15Ramp(s16* dst, const s16* src, size_t samples, s16 from, s16 to)
+{
+    size_t frames = samples / 2;
+    s32 step = RampStep(from, to, frames);
+    s32 base = (s32)from * 65536;
+
+    // Lanes hold the gain of frames f, f, f+1, f+1 and f+2, f+2, f+3, f+3,
+    // matching the L/R interleave of eight samples.
+    s32 init[4] = { base, base, base + step, base + step };
+    int32x4_t acc0 = vld1q_s32(init);
+    int32x4_t acc1 = vaddq_s32(acc0, vdupq_n_s32(2 * step));
+    int32x4_t inc4 = vdupq_n_s32(4 * step);
+    int32x4_t inc8 = vdupq_n_s32(8 * step);
+
+    size_t i;
+    for (i=0; i<samples; i+=16) {
+        int32x4_t acc2 = vaddq_s32(acc0, inc4);
+        int32x4_t acc3 = vaddq_s32(acc1, inc4);
+
+        int16x8_t g0 = vcombine_s16(vshrn_n_s32(acc0, 16), vshrn_n_s32(acc1, 16));
+        int16x8_t g1 = vcombine_s16(vshrn_n_s32(acc2, 16), vshrn_n_s32(acc3, 16));
+
+        int16x8_t x0 = vld1q_s16(src + i);
+        int16x8_t x1 = vld1q_s16(src + i + 8);
+        vst1q_s16(dst + i, vqrdmulhq_s16(x0, g0));
+        vst1q_s16(dst + i + 8, vqrdmulhq_s16(x1, g1));
+
+        acc0 = vaddq_s32(acc0, inc8);
+        acc1 = vaddq_s32(acc1, inc8);
+    }
+}
+
+// Scalar model of the routing, one stereo frame.
+static inline void RouteFrame(DspRouting routing, s16* l, s16* r)
+{
+    s16 in_l = *l;
+    s16 in_r = *r;
+
+    switch (routing) {
+    case DspRouting::Stereo:
+        break;
+    case DspRouting::Mono:
+        *l = *r = (s16)(((s32)in_l + in_r + 1) >> 1);
+        break;
+    case DspRouting::Swap:
+        *l = in_r;
+        *r = in_l;
+        break;
+    case DspRouting::Left:
+        *r = in_l;
+        break;
+    case DspRouting::Right:
+        *l = in_r;
+        break;
+    }
+}
+
+// The routing of four stereo frames; resolved at compile time, so the loop
+// doesn't branch on it.
+template<DspRouting R>
+static inline int16x8_t Route(int16x8_t x)
+{
+    if constexpr (R == DspRouting::Mono)
+        return vrhaddq_s16(x, vrev32q_s16(x));
+    else if constexpr (R == DspRouting::Swap)
+        return vrev32q_s16(x);
+    else if constexpr (R == DspRouting::Left)
+        return vtrn1q_s16(x, x);
+    else if constexpr (R == DspRouting::Right)
+        return vtrn2q_s16(x, x);
+    else
+        return x;
+}
+
+void DspApplyRoutingScalar(s16* dst, const s16* src, size_t samples, DspRouting routing)
+{
+    size_t i;
+    for (i=0; i<samples; i+=2) {
+        s16 l = src[i + 0];
+        s16 r = src[i + 1];
+        RouteFrame(routing, &l, &r);
+        dst[i + 0] = l;
+        dst[i + 1] = r;
+    }
+}
+
+template<DspRouting R>
+static void ApplyRouting(s16* dst, const s16* src, size_t samples)
+{
+    size_t i;
+    for (i=0; i<samples; i+=16) {
+        int16x8_t x0 = Route<R>(vld1q_s16(src + i));
+        int16x8_t x1 = Route<R>(vld1q_s16(src + i + 8));
+        vst1q_s16(dst + i, x0);
+        vst1q_s16(dst + i + 8, x1);
+    }
+}
+
+void DspApplyRouting(s16* dst, const s16* src, size_t samples, DspRouting routing)
+{
+    // In DspRouting order.
+    static void (* const kernels[])(s16*, const s16*, size_t) = {
+        ApplyRouting<DspRouting::Stereo>,
+        ApplyRouting<DspRouting::Mono>,
+        ApplyRouting<DspRouting::Swap>,
+        ApplyRouting<DspRouting::Left>,
+        ApplyRouting<DspRouting::Right>,
+    };
+
+    kernels[(size_t)routing](dst, src, samples);
+}
+
+void DspLimiterInit(DspLimiterState* state, s16 ceiling, u32 sample_rate)
+{
+    u32 blocks_per_s = sample_rate / 4;
+
+    *state = {};
+    state->ceiling = ceiling;
+    // From full reduction back to unity in DSP_LIMITER_RELEASE_MS.
+    state->release = (s32)((u64)DSP_Q15_ONE * 1000 / ((u64)blocks_per_s * DSP_LIMITER_RELEASE_MS));
+    state->trip_limit = blocks_per_s * DSP_SAFETY_TRIP_MS / 1000;
+    state->clear_limit = blocks_per_s * DSP_SAFETY_CLEAR_MS / 1000;
+
+    for (size_t i = 0; i < DSP_LIMITER_BLOCKS; i++) {
+        state->need[i] = DSP_Q15_ONE;
+        state->envelope[i] = DSP_Q15_ONE;
+    }
+
+    state->envelope_sum = DSP_LIMITER_BLOCKS * DSP_Q15_ONE;
+}
+
+// Full scale and DC levels the safety detector trips at.
+#define SAFETY_FULL_SCALE 32000
+#define SAFETY_DC 8192
+
+// The limiter's and safety detector's bookkeeping for one block of four
+// frames, the same for both paths: takes the block's peak and sum, returns
+// the gain for the block leaving the delay.
+static inline s16 LimiterStep(DspLimiterState* s, s16 peak, s32 sum)
+{
+    // About 20 ms to settle at 48 kHz.
+    s->dc += (sum >> 3) - (s->dc >> 8);
+    s32 dc = s->dc >> 8;
+
+    if (peak >= SAFETY_FULL_SCALE || dc >= SAFETY_DC || dc <= -SAFETY_DC)
+        s->trip_blocks++;
+    else
+        s->trip_blocks = 0;
+
+    if (s->trip_blocks >= s->trip_limit) {
+        s->is_muted = true;
+        s->clear_blocks = 0;
+    }
+    else if (s->is_muted && ++s->clear_blocks >= s->clear_limit) {
+        s->is_muted = false;
+    }
+
+    s32 need = DSP_Q15_ONE;
+
+    if (s->is_muted)
+        need = 0;
+    else if (peak > s->ceiling)
+        need = ((s32)s->ceiling << 15) / peak;
+
+    s->need[s->pos] = need;
+
+    s32 lowest = need;
+    for (size_t i = 0; i < DSP_LIMITER_BLOCKS; i++)
+        lowest = s->need[i] < lowest ? s->need[i] : lowest;
+
+    s32 last = s->envelope[(s->pos + DSP_LIMITER_BLOCKS - 1) % DSP_LIMITER_BLOCKS];
+    s32 envelope = last + s->release < lowest ? last + s->release : lowest;
+
+    s->envelope_sum += envelope - s->envelope[s->pos];
+    s->envelope[s->pos] = envelope;
+    s->pos = (s->pos + 1) % DSP_LIMITER_BLOCKS;
+
+    return (s16)(s->envelope_sum / DSP_LIMITER_BLOCKS);
+}
+
+// The oldest block in the delay, whose place the new one takes.
+static inline s16* LimiterSlot(DspLimiterState* s)
+{
+    s16* slot = s->delay + 8 * s->delay_pos;
+    s->delay_pos = (s->delay_pos + 1) % (DSP_LIMITER_BLOCKS - 1);
+    return slot;
+}
+
+void DspApplyLimiterScalar(s16* dst, const s16* src, size_t samples, DspLimiterState* state)
+{
+    size_t i;
+    for (i=0; i<samples; i+=8) {
+        s16 x[8];
+        s16 peak = 0;
+        s32 sum = 0;
+
+        for (size_t j = 0; j < 8; j++) {
+            x[j] = src[i + j];
+            s16 magnitude = SatS16(x[j] < 0 ? -(s32)x[j] : x[j]);
+            peak = magnitude > peak ? magnitude : peak;
+            sum += x[j];
+        }
+
+        s16 gain = LimiterStep(state, peak, sum);
+        s16* slot = LimiterSlot(state);
+
+        for (size_t j = 0; j < 8; j++) {
+            dst[i + j] = gain == DSP_Q15_ONE ? slot[j] : MulQ15(slot[j], gain);
+            slot[j] = x[j];
+        }
+    }
+}
+
+void DspApplyLimiter(s16* dst, const s16* src, size_t samples, DspLimiterState* state)
+{
+    size_t i;
+    for (i=0; i<samples; i+=8) {
+        int16x8_t x = vld1q_s16(src + i);
+        s16 gain = LimiterStep(state, vmaxvq_s16(vqabsq_s16(x)), vaddlvq_s16(x));
+        s16* slot = LimiterSlot(state);
+        int16x8_t y = vld1q_s16(slot);
+        vst1q_s16(slot, x);
+
+        if (gain != DSP_Q15_ONE)
+            y = vqrdmulhq_s16(y, vdupq_n_s16(gain));
+
+        vst1q_s16(dst + i, y);
+    }
+}
+
+s16 DspPeakScalar(const s16* src, size_t samples)
+{
+    s16 peak = 0;
+
+    size_t i;
+    for (i=0; i<samples; i++) {
+        s16 magnitude = SatS16(src[i] < 0 ? -(s32)src[i] : src[i]);
+        peak = magnitude > peak ? magnitude : peak;
+    }
+
+    return peak;
+}
+
+s16 DspPeak(const s16* src, size_t samples)
+{
+    int16x8_t peak0 = vdupq_n_s16(0);
+    int16x8_t peak1 = vdupq_n_s16(0);
+
+    size_t i;
+    for (i=0; i<samples; i+=16) {
+        peak0 = vmaxq_s16(peak0, vqabsq_s16(vld1q_s16(src + i)));
+        peak1 = vmaxq_s16(peak1, vqabsq_s16(vld1q_s16(src + i + 8)));
+    }
+
+    return vmaxvq_s16(vmaxq_s16(peak0, peak1));
+}
+
+// Row and interpolation weight (Q15) of a Q32.32 position's fraction.
+static inline u32 ResamplePhase(u64 pos)
+{
+    return (u32)pos >> (32 - DSP_RESAMPLE_PHASE_BITS);
+}
+
+static inline s16 ResampleBlend(u64 pos)
+{
+    return ((u32)pos >> (32 - DSP_RESAMPLE_PHASE_BITS - 15)) & 0x7FFF;
+}
+
+// Modified Bessel function of the first kind, order zero, for the window.
+static double BesselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+u32 DspResampleTaps(u32 in_rate, u32 out_rate)
+{
+    u32 taps = 32 * ((in_rate + out_rate - 1) / out_rate);
+    return taps > 64 ? taps : 64;
+}
+
+size_t DspResampleFilterSize(u32 taps)
+{
+    return 2 * (DSP_RESAMPLE_PHASES + 1) * taps;
+}
+
+// Kaiser-windowed sinc, centred between taps taps/2 - 1 and taps/2.
+static double ResampleTap(u32 k, u32 phase, u32 taps, double cutoff, double beta)
+{
+    double half = taps / 2.0;
+    double t = (double)k - (half - 1) - (double)phase / DSP_RESAMPLE_PHASES;
+    double x = t / half;
+
+    double sinc = t == 0 ? 1.0 : sin(2 * DSP_PI * cutoff * t) / (2 * DSP_PI * cutoff * t);
+    double window = x * x < 1 ? BesselI0(beta * sqrt(1 - x * x)) / BesselI0(beta) : 0;
+    return sinc * window;
+}
+
+void DspResampleFilterInit(DspResampleFilter* filter, s16* mem, u32 taps, u32 in_rate, u32 out_rate)
+{
+    #define ResampleStopbandDb 80.0
+
+    // Kaiser's estimates for the transition width (in cycles per input
+    // sample) and window shape that reach the stopband attenuation.
+    double width = (ResampleStopbandDb - 8.0) / (2.285 * 2 * DSP_PI * (taps - 1));
+    double beta = 0.1102 * (ResampleStopbandDb - 8.7);
+    double nyquist = 0.5 * (out_rate < in_rate ? out_rate : in_rate) / in_rate;
+    double cutoff = nyquist - width / 2;
+
+    filter->taps = taps;
+    filter->coefs = mem;
+    filter->deltas = mem + (DSP_RESAMPLE_PHASES + 1) * taps;
+
+    for (u32 p = 0; p <= DSP_RESAMPLE_PHASES; p++) {
+        double sum = 0;
+
+        for (u32 k = 0; k < taps; k++)
+            sum += ResampleTap(k, p, taps, cutoff, beta);
+
+        // Unity gain at DC, for every fractional delay.
+        for (u32 k = 0; k < taps; k++)
+            filter->coefs[p * taps + k] = (s16)lrint(ResampleTap(k, p, taps, cutoff, beta) / sum * 32768.0);
+    }
+
+    for (u32 p = 0; p < DSP_RESAMPLE_PHASES; p++) {
+        for (u32 k = 0; k < taps; k++)
+            filter->deltas[p * taps + k] = filter->coefs[(p + 1) * taps + k] - filter->coefs[p * taps + k];
+    }
+
+    for (u32 k = 0; k < taps; k++)
+        filter->deltas[DSP_RESAMPLE_PHASES * taps + k] = 0;
+}
+
+size_t DspResampleScalar(s16* dst, size_t dst_frames, const s16* src, size_t src_frames,
+    const DspResampleFilter* filter, u64* pos, u64 step)
+{
+    u32 taps = filter->taps;
+    u64 p = *pos;
+
+    size_t n;
+    for (n=0; n<dst_frames && (p >> 32) + taps <= src_frames; n++) {
+        const s16* x = src + 2 * (p >> 32);
+        const s16* c = filter->coefs + ResamplePhase(p) * taps;
+        const s16* d = filter->deltas + ResamplePhase(p) * taps;
+        s16 blend = ResampleBlend(p);
+        s32 left = 0;
+        s32 right = 0;
+
+        for (u32 k=0; k<taps; k++) {
+            s16 coef = (s16)(c[k] + MulQ15(d[k], blend));
+            left += x[2*k + 0] * coef;
+            right += x[2*k + 1] * coef;
+        }
+
+        dst[2*n + 0] = SatS16((left + (1 << 14)) >> 15);
+        dst[2*n + 1] = SatS16((right + (1 << 14)) >> 15);
+        p += step;
+    }
+
+    *pos = p;
+    return n;
+}
+
+size_t DspResample(s16* dst, size_t dst_frames, const s16* src, size_t src_frames,
+    const DspResampleFilter* filter, u64* pos, u64 step)
+{
+    u32 taps = filter->taps;
+    u64 p = *pos;
+
+    size_t n;
+    for (n=0; n<dst_frames && (p >> 32) + taps <= src_frames; n++) {
+        const s16* x = src + 2 * (p >> 32);
+        const s16* c = filter->coefs + ResamplePhase(p) * taps;
+        const s16* d = filter->deltas + ResamplePhase(p) * taps;
+        int16x8_t blend = vdupq_n_s16(ResampleBlend(p));
+        int32x4_t left = vdupq_n_s32(0);
+        int32x4_t right = vdupq_n_s32(0);
+
+        for (u32 k=0; k<taps; k+=8) {
+            // Interpolate 8 coefficients between the two rows.
+            int16x8_t coef = vaddq_s16(vld1q_s16(c + k), vqrdmulhq_s16(vld1q_s16(d + k), blend));
+            int16x8x2_t lr = vld2q_s16(x + 2*k);   // 8 frames, split into L and R.
+
+            left = vmlal_s16(left, vget_low_s16(lr.val[0]), vget_low_s16(coef));
+            left = vmlal_s16(left, vget_high_s16(lr.val[0]), vget_high_s16(coef));
+            right = vmlal_s16(right, vget_low_s16(lr.val[1]), vget_low_s16(coef));
+            right = vmlal_s16(right, vget_high_s16(lr.val[1]), vget_high_s16(coef));
+        }
+
+        // The sums can't overflow: each row's magnitudes add up to < 2.0.
+        dst[2*n + 0] = SatS16((vaddvq_s32(left) + (1 << 14)) >> 15);
+        dst[2*n + 1] = SatS16((vaddvq_s32(right) + (1 << 14)) >> 15);
+        p += step;
+    }
+
+    *pos = p;
+    return n;
+}
+
+void DspEqDesign(const DspEqBand* band, u32 sample_rate, double* b, double* a)
+{
+    double A = pow(10.0, band->gain_db / 40.0);
+    double w0 = 2 * DSP_PI * band->freq_hz / sample_rate;
+    double cs = cos(w0);
+    double alpha = sin(w0) / (2 * band->q);
+    double beta = 2 * sqrt(A) * alpha;
+
+    switch (band->type) {
+    case DspEqType::Peak:
+        b[0] = 1 + alpha * A;
+        b[1] = -2 * cs;
+        b[2] = 1 - alpha * A;
+        a[0] = 1 + alpha / A;
+        a[1] = -2 * cs;
+        a[2] = 1 - alpha / A;
+        break;
+
+    case DspEqType::LowShelf:
+        b[0] = A * ((A + 1) - (A - 1) * cs + beta);
+        b[1] = 2 * A * ((A - 1) - (A + 1) * cs);
+        b[2] = A * ((A + 1) - (A - 1) * cs - beta);
+        a[0] = (A + 1) + (A - 1) * cs + beta;
+        a[1] = -2 * ((A - 1) + (A + 1) * cs);
+        a[2] = (A + 1) + (A - 1) * cs - beta;
+        break;
+
+    case DspEqType::HighShelf:
+        b[0] = A * ((A + 1) + (A - 1) * cs + beta);
+        b[1] = -2 * A * ((A - 1) + (A + 1) * cs);
+        b[2] = A * ((A + 1) + (A - 1) * cs - beta);
+        a[0] = (A + 1) - (A - 1) * cs + beta;
+        a[1] = 2 * ((A - 1) - (A + 1) * cs);
+        a[2] = (A + 1) - (A - 1) * cs - beta;
+        break;
+
+    case DspEqType::LowPass:
+        b[0] = (1 - cs) / 2;
+        b[1] = 1 - cs;
+        b[2] = (1 - cs) / 2;
+        a[0] = 1 + alpha;
+        a[1] = -2 * cs;
+        a[2] = 1 - alpha;
+        break;
+
+    case DspEqType::HighPass:
+        b[0] = (1 + cs) / 2;
+        b[1] = -(1 + cs);
+        b[2] = (1 + cs) / 2;
+        a[0] = 1 + alpha;
+        a[1] = -2 * cs;
+        a[2] = 1 - alpha;
+        break;
+    }
+}
+
+void DspEqInit(DspEqState* state, const DspEqBand* bands, size_t num_bands, u32 sample_rate)
+{
+    *state = {};
+
+    for (size_t i = 0; i < num_bands && state->num_bands < DSP_EQ_MAX_BANDS; i++) {
+        const DspEqBand& band = bands[i];
+
+        // Written so that NaNs fail too.
+        if (!(band.freq_hz > 0 && band.freq_hz < sample_rate / 2 && band.q > 0 && isfinite(band.gain_db)))
+            continue;
+
+        double b[3];
+        double a[3];
+        DspEqDesign(&band, sample_rate, b, a);
+
+        DspBiquad& q = state->biquads[state->num_bands++];
+        q.b0 = (float)(b[0] / a[0]);
+        q.b1 = (float)(b[1] / a[0]);
+        q.b2 = (float)(b[2] / a[0]);
+        q.na1 = (float)(-a[1] / a[0]);
+        q.na2 = (float)(-a[2] / a[0]);
+    }
+}
+
+static inline float32x4_t EqClamp(float32x4_t v)
+{
+    return vminq_f32(vmaxq_f32(v, vdupq_n_f32(-32768.0f)), vdupq_n_f32(32767.0f));
+}
+
+// Each band runs over a block's four frames before the next, so its state
+// stays in registers; per frame, that is the same order as the scalar path.
+void DspApplyEq(s16* dst, const s16* src, size_t samples, DspEqState* state)
+{
+    size_t i;
+    for (i=0; i<samples; i+=8) {
+        int16x8_t x = vld1q_s16(src + i);
+        float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(x)));
+        float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(x)));
+        float32x2_t f[4] = { vget_low_f32(lo), vget_high_f32(lo), vget_low_f32(hi), vget_high_f32(hi) };
+
+        for (u32 b = 0; b < state->num_bands; b++) {
+            const DspBiquad& q = state->biquads[b];
+            float32x4_t z = vld1q_f32(state->z[b]);
+            float32x2_t z1 = vget_low_f32(z);
+            float32x2_t z2 = vget_high_f32(z);
+
+            for (size_t j = 0; j < 4; j++) {
+                float32x2_t y = vfma_n_f32(z1, f[j], q.b0);
+                z1 = vfma_n_f32(vfma_n_f32(z2, y, q.na1), f[j], q.b1);
+                z2 = vfma_n_f32(vmul_n_f32(y, q.na2), f[j], q.b2);
+                f[j] = y;
+            }
+
+            vst1q_f32(state->z[b], vcombine_f32(z1, z2));
+        }
+
+        lo = EqClamp(vcombine_f32(f[0], f[1]));
+        hi = EqClamp(vcombine_f32(f[2], f[3]));
+
+        vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(lo)), vqmovn_s32(vcvtnq_s32_f32(hi))));
+    }
+}
+
+void DspApplyEqScalar(s16* dst, const s16* src, size_t samples, DspEqState* state)
+{
+    size_t i;
+    for (i=0; i<samples; i+=2) {
+        float f[2] = { (float)src[i + 0], (float)src[i + 1] };
+
+        for (u32 b = 0; b < state->num_bands; b++) {
+            const DspBiquad& q = state->biquads[b];
+            float* z = state->z[b];
+
+            for (size_t c = 0; c < 2; c++) {
+                float y = fmaf(f[c], q.b0, z[c]);
+                z[c] = fmaf(f[c], q.b1, fmaf(y, q.na1, z[2 + c]));
+                z[2 + c] = fmaf(f[c], q.b2, y * q.na2);
+                f[c] = y;
+            }
+        }
+
+        for (size_t c = 0; c < 2; c++)
+            dst[i + c] = (s16)lrintf(fminf(fmaxf(f[c], -32768.0f), 32767.0f));
+    }
+}
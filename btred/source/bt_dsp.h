@@ -0,0 +1,168 @@
+#pragma once
+
+// Per-buffer PCM kernels. Buffers are interleaved stereo s16, and sample
+// counts must be a multiple of 16 for the NEON paths. Kernels read src and
+// write dst, which may be the same buffer. Each kernel has a scalar
+// reference that the NEON version must match bit for bit.
+
+// Q15 gain: 0x7FFF is (almost) unity.
+#define DSP_Q15_ONE 0x7FFF
+
+s16  DspGainToQ15(float gain);
+
+// dst[i] = src[i] * gain, rounded, in Q15.
+void DspApplyGainQ15(s16* dst, const s16* src, size_t samples, s16 gain);
+void DspApplyGainQ15Scalar(s16* dst, const s16* src, size_t samples, s16 gain);
+
+// Same, with the gain ramped linearly per stereo frame from `from` towards
+// `to` over the buffer, so that volume steps do not produce zipper noise.
+// The last frame is one step short of `to`; the next buffer starts there.
+void DspApplyGainQ15Ramp(s16* dst, const s16* src, size_t samples, s16 from, s16 to);
+void DspApplyGainQ15RampScalar(s16* dst, const s16* src, size_t samples, s16 from, s16 to);
+
+// What each output channel carries, for single-earbud use and the like.
+// A pass of its own, so that stereo costs nothing for it.
+enum class DspRouting {
+    Stereo,     // as captured
+    Mono,       // (L + R) / 2 on both, rounded
+    Swap,       // R on the left, L on the right
+    Left,       // L on both
+    Right,      // R on both
+};
+
+void DspApplyRouting(s16* dst, const s16* src, size_t samples, DspRouting routing);
+void DspApplyRoutingScalar(s16* dst, const s16* src, size_t samples, DspRouting routing);
+
+// Look-ahead peak limiter, so that loud content is turned down rather than
+// clipped. The gain for each block of four frames is the smallest that any
+// block up to DSP_LIMITER_BLOCKS - 1 ahead needs to stay under the ceiling,
+// averaged over DSP_LIMITER_BLOCKS blocks so that it moves smoothly, which
+// never lets a peak through; it recovers linearly, over
+// DSP_LIMITER_RELEASE_MS. The audio is delayed by the look-ahead.
+//
+// Its safety detector mutes the output, through the same envelope, when it
+// sits at full scale or far off zero (DC) for DSP_SAFETY_TRIP_MS, the way a
+// broken stream or a misbehaving driver sounds, and unmutes it once that
+// stopped for DSP_SAFETY_CLEAR_MS. Odd clipped samples in music do not count.
+#define DSP_LIMITER_BLOCKS 8
+#define DSP_LIMITER_DELAY_FRAMES (4 * (DSP_LIMITER_BLOCKS - 1))
+#define DSP_LIMITER_RELEASE_MS 50
+#define DSP_SAFETY_TRIP_MS 100
+#define DSP_SAFETY_CLEAR_MS 1000
+
+struct DspLimiterState {
+    s16  ceiling;
+    bool is_muted;
+    s16  delay[8 * (DSP_LIMITER_BLOCKS - 1)];
+    u32  delay_pos;
+    s32  need[DSP_LIMITER_BLOCKS];      // Q15 gain each block needs
+    s32  envelope[DSP_LIMITER_BLOCKS];
+    u32  pos;
+    s32  envelope_sum;
+    s32  release;                       // per block
+    s32  dc;                            // Q8, smoothed block mean
+    u32  trip_blocks;
+    u32  trip_limit;
+    u32  clear_blocks;
+    u32  clear_limit;
+};
+
+// ceiling is Q15 of full scale; at DSP_Q15_ONE, nothing is limited and only
+// the safety detector acts. The rate sets the time constants.
+void DspLimiterInit(DspLimiterState* state, s16 ceiling, u32 sample_rate);
+
+// dst = src through the limiter, DSP_LIMITER_DELAY_FRAMES late. Goes after
+// the volume, so that the ceiling is where the headset is driven to,
+// whatever the volume.
+void DspApplyLimiter(s16* dst, const s16* src, size_t samples, DspLimiterState* state);
+void DspApplyLimiterScalar(s16* dst, const s16* src, size_t samples, DspLimiterState* state);
+
+// The largest magnitude in the buffer; at or below DSP_SILENCE_LEVEL, the
+// buffer is silence.
+#define DSP_SILENCE_LEVEL 8 // about -72 dBFS
+
+s16  DspPeak(const s16* src, size_t samples);
+s16  DspPeakScalar(const s16* src, size_t samples);
+
+// Polyphase FIR resampling, for audio outs started at a lower rate than the
+// capture, and for following a headset's clock. The filter is a
+// Kaiser-windowed sinc, tabulated at DSP_RESAMPLE_PHASES fractional delays;
+// each output interpolates its coefficients linearly between the two nearest
+// rows, so the ratio is not limited to small fractions, and can be nudged
+// between calls.
+#define DSP_RESAMPLE_PHASE_BITS 6
+#define DSP_RESAMPLE_PHASES (1 << DSP_RESAMPLE_PHASE_BITS)
+
+struct DspResampleFilter {
+    u32  taps;      // per row, a multiple of 8
+    s16* coefs;     // DSP_RESAMPLE_PHASES + 1 rows, Q15, each summing to one
+    s16* deltas;    // row p+1 - row p
+};
+
+// Enough taps to keep aliasing 80 dB down with a usable passband: at least
+// 64, which leaves 48 kHz its passband up to 20 kHz, and more the further the
+// rate drops.
+u32    DspResampleTaps(u32 in_rate, u32 out_rate);
+
+// s16 table entries of a filter with that many taps.
+size_t DspResampleFilterSize(u32 taps);
+
+// Builds the tables in mem. The stopband starts at the lower of the two
+// Nyquist frequencies.
+void   DspResampleFilterInit(DspResampleFilter* filter, s16* mem, u32 taps, u32 in_rate, u32 out_rate);
+
+// Writes up to dst_frames stereo frames while the filter still fits into the
+// src_frames of input. *pos is where the first tap lands for the next output,
+// in input frames, Q32.32, and moves on by step per output; the output is
+// the input at *pos + taps/2 - 1. Returns the number of frames written.
+size_t DspResample(s16* dst, size_t dst_frames, const s16* src, size_t src_frames,
+    const DspResampleFilter* filter, u64* pos, u64 step);
+size_t DspResampleScalar(s16* dst, size_t dst_frames, const s16* src, size_t src_frames,
+    const DspResampleFilter* filter, u64* pos, u64 step);
+
+// Parametric EQ, as a cascade of biquads (RBJ's cookbook filters), for a
+// headset's own curve. Both channels run through the same bands, in float,
+// one frame at a time as an L/R pair; coefficients are computed once, by
+// DspEqInit.
+#define DSP_EQ_MAX_BANDS 8
+
+enum class DspEqType {
+    Peak,       // gain_db around freq_hz, q wide
+    LowShelf,   // gain_db below freq_hz, 0.707 q for no overshoot
+    HighShelf,  // gain_db above freq_hz, likewise
+    LowPass,    // 12 dB/octave above freq_hz, q the resonance
+    HighPass,   // 12 dB/octave below freq_hz
+};
+
+struct DspEqBand {
+    DspEqType type;
+    float freq_hz;
+    float gain_db;  // peak and shelves only
+    float q;
+};
+
+// Normalised to a0 = 1, with the feedback terms negated.
+struct DspBiquad {
+    float b0;
+    float b1;
+    float b2;
+    float na1;
+    float na2;
+};
+
+struct DspEqState {
+    u32 num_bands;
+    DspBiquad biquads[DSP_EQ_MAX_BANDS];
+    float z[DSP_EQ_MAX_BANDS][4];   // transposed direct form II: z1 L/R, z2 L/R
+};
+
+// Bands past DSP_EQ_MAX_BANDS, at or over Nyquist, without a positive q, or
+// with a gain that isn't finite are dropped. Clears the filter state.
+void DspEqInit(DspEqState* state, const DspEqBand* bands, size_t num_bands, u32 sample_rate);
+
+// The coefficients of one band, in double precision, for checking against.
+void DspEqDesign(const DspEqBand* band, u32 sample_rate, double* b, double* a);
+
+// dst = src through the cascade, rounded and saturated to s16.
+void DspApplyEq(s16* dst, const s16* src, size_t samples, DspEqState* state);
+void DspApplyEqScalar(s16* dst, const s16* src, size_t samples, DspEqState* state);
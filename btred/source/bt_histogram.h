@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+
+// Fixed-size log-linear histogram of u32 values (microseconds, unless noted
+// otherwise where it is declared). Values below 8 get
+// exact buckets; above that, every power of two is split into four buckets,
+// so percentiles are accurate to within 25%, with no allocation and O(1)
+// recording.
+//
+// Single writer. Readers on other threads see a consistent-enough view for
+// reporting; counts are never torn.
+class BtHistogram {
+public:
+    #define HISTOGRAM_BUCKETS (8 + 29*4)
+
+    BtHistogram() { Reset(); }
+
+    void Reset() {
+        for (auto& b: m_buckets)
+            b.store(0, std::memory_order_relaxed);
+        m_count.store(0, std::memory_order_relaxed);
+        m_max.store(0, std::memory_order_relaxed);
+    }
+
+    void Record(u64 value) {
+        u32 v = value > 0xFFFFFFFFULL ? 0xFFFFFFFF : (u32)value;
+        auto& b = m_buckets[Index(v)];
+
+        b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        m_count.store(m_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        if (v > m_max.load(std::memory_order_relaxed))
+            m_max.store(v, std::memory_order_relaxed);
+    }
+
+    u32 GetCount() { return m_count.load(std::memory_order_relaxed); }
+    u32 GetMax()   { return m_max.load(std::memory_order_relaxed); }
+
+    // Upper bound of the bucket holding the given percentile, capped at the
+    // exact max.
+    u32 GetPercentile(u32 percent) {
+        u32 count = GetCount();
+
+        if (count == 0)
+            return 0;
+
+        u32 rank = (u32)(((u64)count * percent + 99) / 100);
+        u32 seen = 0;
+
+        for (u32 i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+
+            if (seen >= rank) {
+                u32 upper = UpperBound(i);
+                u32 max = GetMax();
+                return upper < max ? upper : max;
+            }
+        }
+
+        return GetMax();
+    }
+
+private:
+    static u32 Index(u32 v) {
+        if (v < 8)
+            return v;
+
+        u32 msb = 31 - __builtin_clz(v);
+        u32 sub = (v >> (msb - 2)) & 3;
+        return 8 + (msb - 3) * 4 + sub;
+    }
+
+    static u32 UpperBound(u32 idx) {
+        if (idx < 8)
+            return idx;
+
+        u32 msb = (idx - 8) / 4 + 3;
+        u32 sub = (idx - 8) % 4;
+        u64 lower = (u64)(4 + sub) << (msb - 2);
+        u64 upper = lower + (1ULL << (msb - 2)) - 1;
+        return upper > 0xFFFFFFFFULL ? 0xFFFFFFFF : (u32)upper;
+    }
+
+private:
+    std::atomic<u32> m_buckets[HISTOGRAM_BUCKETS];
+    std::atomic<u32> m_count;
+    std::atomic<u32> m_max;
+};
@@ -0,0 +1,101 @@
+#include <switch.h>
+#include "bt_parked_thread.h"
+
+BtParkedThread::BtParkedThread():
+    m_is_initialized(false),
+    m_func(NULL),
+    m_arg(NULL)
+{ }
+
+BtParkedThread::~BtParkedThread()
+{
+    Finalize();
+}
+
+Result BtParkedThread::Initialize(void* stack, size_t stack_size, int prio, int cpuid)
+{
+    Result rc;
+
+    rc = threadCreate(
+        &m_thread,
+        (ThreadFunc) ThreadTrampoline,
+        (void*) this,
+        stack,
+        stack_size,
+        prio,
+        cpuid);
+
+    if (R_FAILED(rc)) {
+        return rc;
+    }
+
+    ueventCreate(&m_exitsignal, false);
+    ueventCreate(&m_run_signal, true);
+    ueventCreate(&m_parked_signal, true);
+
+    rc = threadStart(&m_thread);
+
+    if (R_FAILED(rc)) {
+        threadClose(&m_thread);
+        return rc;
+    }
+
+    m_is_initialized = true;
+    return rc;
+}
+
+void BtParkedThread::Finalize()
+{
+    // Only while parked.
+    if (m_is_initialized) {
+        ueventSignal(&m_exitsignal);
+        threadWaitForExit(&m_thread);
+        threadClose(&m_thread);
+        m_is_initialized = false;
+    }
+}
+
+void BtParkedThread::Run(ThreadFunc func, void* arg)
+{
+    // The signal orders these for the thread.
+    m_func = func;
+    m_arg = arg;
+    ueventSignal(&m_run_signal);
+}
+
+void BtParkedThread::Join()
+{
+    int idx;
+    waitMulti(&idx, -1, waiterForUEvent(&m_parked_signal));
+}
+
+void BtParkedThread::ThreadLoop()
+{
+    bool running = true;
+    Result rc = 0;
+
+    while (running)
+    {
+        int idx;
+
+        rc = waitMulti(
+            &idx, -1,
+            waiterForUEvent(&m_exitsignal),
+            waiterForUEvent(&m_run_signal));
+
+        if (R_FAILED(rc))
+            fatalThrow(rc);
+
+        switch (idx)
+        {
+            case 0: // m_exitsignal
+                running = false;
+                break;
+
+            case 1: // m_run_signal
+                m_func(m_arg);
+                ueventSignal(&m_parked_signal);
+                break;
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+// A thread that is created once and then runs one job at a time, parking in
+// between. Handing it a new job costs two signals, rather than a thread
+// create on the way in and a join and close on the way out.
+class BtParkedThread {
+public:
+    BtParkedThread();
+    ~BtParkedThread();
+
+    Result Initialize(void* stack, size_t stack_size, int prio, int cpuid);
+    void   Finalize();
+
+    bool IsInitialized() const { return m_is_initialized; }
+
+    // Runs func(arg) on the thread and returns right away. The previous job
+    // must have been joined.
+    void Run(ThreadFunc func, void* arg);
+
+    // Waits for the job to return; it must have been told to.
+    void Join();
+
+private:
+    static void ThreadTrampoline(BtParkedThread* self) {
+        self->ThreadLoop();
+    }
+    void ThreadLoop();
+
+private:
+    bool   m_is_initialized;
+    Thread m_thread;
+    UEvent m_exitsignal;
+    UEvent m_run_signal;
+    UEvent m_parked_signal;
+    ThreadFunc m_func;
+    void*  m_arg;
+};
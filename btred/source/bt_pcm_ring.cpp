@@ -0,0 +1,31 @@
+#include <switch.h>
+#include "bt_pcm_ring.h"
+
+BtPcmRing::BtPcmRing():
+    m_slots(NULL),
+    m_num_periods(0),
+    m_head(0),
+    m_tail(0),
+    m_high_water(0),
+    m_overruns(0),
+    m_underruns(0)
+{ }
+
+BtPcmRing::~BtPcmRing()
+{
+    Finalize();
+}
+
+void BtPcmRing::Initialize(BtPcmPeriod** slots, size_t num_periods)
+{
+    m_slots = slots;
+    m_num_periods = num_periods;
+    m_head = 0;
+    m_tail = 0;
+}
+
+void BtPcmRing::Finalize()
+{
+    m_slots = NULL;
+    m_num_periods = 0;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+
+// One captured period, shared read-only by every device it was fanned out
+// to. It goes back to the capture pool once the last reference is dropped.
+struct BtPcmPeriod {
+    std::atomic<u32> refs;
+    u64  release_ns;  // audrec released the capture buffer
+    u64  gain_ns;     // gain pass finished writing samples
+    s16* samples;
+    bool is_silent;   // nothing above DSP_SILENCE_LEVEL
+
+    void Release() { refs.fetch_sub(1, std::memory_order_acq_rel); }
+};
+
+// Single-producer/single-consumer ring of period references.
+//
+// The producer publishes with Push(); the consumer peeks with Front() and
+// retires with Pop(). Neither side ever blocks or takes a lock. A full ring
+// refuses the incoming period (overrun) rather than overwrite one the
+// consumer may be reading.
+class BtPcmRing {
+public:
+    BtPcmRing();
+    ~BtPcmRing();
+
+    // The slots are the caller's, and must outlive the ring's use.
+    void Initialize(BtPcmPeriod** slots, size_t num_periods);
+    void Finalize();
+
+    bool Push(BtPcmPeriod* period) {
+        u64 head = m_head.load(std::memory_order_relaxed);
+        u64 tail = m_tail.load(std::memory_order_acquire);
+
+        if (head - tail == m_num_periods) {
+            m_overruns.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        m_slots[head % m_num_periods] = period;
+        m_head.store(head + 1, std::memory_order_release);
+
+        u32 fill = (u32)(head + 1 - tail);
+        if (fill > m_high_water.load(std::memory_order_relaxed))
+            m_high_water.store(fill, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    BtPcmPeriod* Front() {
+        u64 tail = m_tail.load(std::memory_order_relaxed);
+
+        if (m_head.load(std::memory_order_acquire) == tail)
+            return NULL;
+
+        return m_slots[tail % m_num_periods];
+    }
+
+    // The newest period, which the producer won't touch either until it is
+    // popped.
+    BtPcmPeriod* Back() {
+        u64 head = m_head.load(std::memory_order_acquire);
+
+        if (head == m_tail.load(std::memory_order_relaxed))
+            return NULL;
+
+        return m_slots[(head - 1) % m_num_periods];
+    }
+
+    void Pop() {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    void CountUnderrun() { m_underruns.fetch_add(1, std::memory_order_relaxed); }
+
+    u32 GetFill()      { return (u32)(m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_relaxed)); }
+    u32 GetCapacity()  { return m_num_periods; }
+    u32 GetHighWater() { return m_high_water.load(std::memory_order_relaxed); }
+    u64 GetOverruns()  { return m_overruns.load(std::memory_order_relaxed); }
+    u64 GetUnderruns() { return m_underruns.load(std::memory_order_relaxed); }
+
+private:
+    BtPcmPeriod** m_slots;
+    u32    m_num_periods;
+
+    // Producer and consumer indices live on separate cache lines. They only
+    // ever increase; fill is always head - tail.
+    alignas(64) std::atomic<u64> m_head;
+    alignas(64) std::atomic<u64> m_tail;
+
+    alignas(64) std::atomic<u32> m_high_water;
+    std::atomic<u64> m_overruns;
+    std::atomic<u64> m_underruns;
+};
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <switch.h>
+#include "bt_config.h"
+#include "bt_driver_lock.h"
+#include "bt_reconnect.h"
+#include "bt_telemetry.h"
+
+//#define ENABLE_TRACE
+
+#ifdef ENABLE_TRACE
+#define TRACE(...) printf(__VA_ARGS__)
+#else
+#define TRACE(...)
+#endif
+
+// 1, 2, 4, 8, 8, ... seconds, for about a minute; then every 30 seconds.
+#define RECONNECT_MIN_DELAY_NS  (1000000000ULL)
+#define RECONNECT_MAX_DELAY_NS  (8000000000ULL)
+#define RECONNECT_FAST_ATTEMPTS 10
+#define RECONNECT_SLOW_DELAY_NS (30000000000ULL)
+
+
+BtReconnect::BtReconnect():
+    m_deadline_ns(0),
+    m_is_connected(false),
+    m_was_connected(false),
+    m_attempts(0),
+    m_lost_ns(0),
+    m_last_attempt_ns(0)
+{
+    ueventCreate(&m_resume_event, true);
+}
+
+void BtReconnect::Update(bool is_connected)
+{
+    u64 now = armTicksToNs(svcGetSystemTick());
+
+    if (is_connected) {
+        if (!m_is_connected) {
+            m_deadline_ns = 0;
+
+            // Boot doesn't count as losing the link.
+            if (m_was_connected) {
+                BtSystemTelemetry& stats = g_telemetry.System();
+                BtDeviceTelemetry::Bump(stats.reconnects);
+                stats.time_to_reconnect.Record((now - m_lost_ns) / 1000000);
+            }
+
+            TRACE("[?] reconnected after %u attempts\n", m_attempts);
+        }
+
+        m_is_connected = true;
+        m_was_connected = true;
+        m_attempts = 0;
+        return;
+    }
+
+    if (m_is_connected || m_lost_ns == 0) {
+        m_is_connected = false;
+        m_lost_ns = now;
+        m_attempts = 0;
+    }
+
+    // Any connection event is a hint that something changed, so it's worth
+    // trying again right away. Not more than the shortest backoff, though,
+    // in case our own attempts are what's causing the events.
+    if (m_last_attempt_ns == 0 || now - m_last_attempt_ns >= RECONNECT_MIN_DELAY_NS)
+        Attempt();
+}
+
+u64 BtReconnect::GetTimeout()
+{
+    u64 now = armTicksToNs(svcGetSystemTick());
+
+    if (m_deadline_ns == 0)
+        return UINT64_MAX;
+
+    return m_deadline_ns > now ? m_deadline_ns - now : 0;
+}
+
+void BtReconnect::OnTimer()
+{
+    // The timeout may have been worked out before a suspend, or a connect,
+    // cancelled it.
+    if (m_deadline_ns == 0 || GetTimeout() != 0)
+        return;
+
+    m_deadline_ns = 0;
+
+    if (!m_is_connected)
+        Attempt();
+}
+
+void BtReconnect::Suspend()
+{
+    // No connection may be opened while asleep.
+    m_deadline_ns = 0;
+    m_is_connected = false;
+}
+
+void BtReconnect::Resume()
+{
+    ueventSignal(&m_resume_event);
+}
+
+void BtReconnect::OnResume()
+{
+    // Sleep itself isn't link loss; count from the wake-up. Give btdrv a
+    // moment before the first attempt.
+    m_lost_ns = armTicksToNs(svcGetSystemTick());
+    m_attempts = 0;
+    Schedule(RECONNECT_MIN_DELAY_NS);
+}
+
+void BtReconnect::Attempt()
+{
+    // Nothing to reconnect to until a headset was connected once, but keep
+    // the schedule going; the address may show up later.
+    if (g_config.HasHeadphonesBtAddress()) {
+        TRACE("[?] reconnect attempt %u\n", m_attempts);
+
+        g_btdrv_control_lock.Lock();
+        btdrvOpenAudioConnection(g_config.GetHeadphonesBtAddress());
+        g_btdrv_control_lock.Unlock();
+
+        BtDeviceTelemetry::Bump(g_telemetry.System().reconnect_attempts);
+    }
+
+    m_last_attempt_ns = armTicksToNs(svcGetSystemTick());
+
+    // The result only shows up as a connection event; until then, assume
+    // the attempt failed.
+    u64 delay;
+
+    if (m_attempts < RECONNECT_FAST_ATTEMPTS) {
+        delay = RECONNECT_MIN_DELAY_NS << m_attempts;
+        delay = delay < RECONNECT_MAX_DELAY_NS ? delay : RECONNECT_MAX_DELAY_NS;
+    }
+    else {
+        delay = RECONNECT_SLOW_DELAY_NS;
+    }
+
+    m_attempts++;
+
+    // +-20%
+    u64 jitter = delay / 5;
+    Schedule(delay - jitter + randomGet64() % (2 * jitter));
+}
+
+void BtReconnect::Schedule(u64 delay_ns)
+{
+    m_deadline_ns = armTicksToNs(svcGetSystemTick()) + delay_ns;
+}
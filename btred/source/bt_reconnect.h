@@ -0,0 +1,41 @@
+#pragma once
+
+// Brings the saved headset back after the link drops. An attempt is made as
+// soon as we notice the loss, then retried with exponential backoff (plus
+// jitter, so we don't page in lockstep with anything else), and after a
+// while only at a slow interval, so an absent headset costs next to nothing.
+//
+// Driven from the manager thread, which owns all of its state: Update()
+// after every change to the device list, OnTimer() once GetTimeout() ran
+// out, OnResume() when GetResumeEvent() fires. Suspend() and Resume() come
+// from the PSC listener; Suspend() while the manager thread is held off, and
+// Resume() only signals it.
+class BtReconnect {
+public:
+    BtReconnect();
+
+    void Update(bool is_connected);
+    void OnTimer();
+    void OnResume();
+
+    void Suspend();
+    void Resume();
+
+    // Until the next attempt is due, for the manager's wait; UINT64_MAX if
+    // none is.
+    u64 GetTimeout();
+    UEvent* GetResumeEvent() { return &m_resume_event; }
+
+private:
+    void Attempt();
+    void Schedule(u64 delay_ns);
+
+private:
+    UEvent m_resume_event;
+    u64    m_deadline_ns;       // of the next attempt, 0 = none
+    bool   m_is_connected;
+    bool   m_was_connected;
+    u32    m_attempts;          // since the link was lost
+    u64    m_lost_ns;
+    u64    m_last_attempt_ns;
+};
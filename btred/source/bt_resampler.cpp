@@ -0,0 +1,71 @@
+#include <string.h>
+#include <switch.h>
+#include "bt_resampler.h"
+
+// Interleaved stereo, like every kernel in bt_dsp.
+#define RESAMPLE_FRAME_BYTES (2 * sizeof(s16))
+
+BtResampler::BtResampler():
+    m_filter(NULL),
+    m_history(NULL),
+    m_history_frames(0),
+    m_out(NULL),
+    m_out_capacity(0),
+    m_pos(0),
+    m_step(0),
+    m_nominal_step(0)
+{ }
+
+AudioFrames BtResampler::MaxOutput(AudioFrames period, u32 in_rate, u32 out_rate)
+{
+    // Rounded up, with room for the odd extra frame the carried-over input
+    // makes, and for the step being TUNING_MAX_DRIFT_PPM short.
+    return { (period.count * out_rate + in_rate - 1) / in_rate + 8 };
+}
+
+size_t BtResampler::MemSize(const DspResampleFilter* filter, AudioFrames period, u32 in_rate, u32 out_rate)
+{
+    // The filter stops with fewer than taps frames left over.
+    size_t history = filter->taps + period.count;
+    size_t out = MaxOutput(period, in_rate, out_rate).count;
+
+    return (history + out) * RESAMPLE_FRAME_BYTES;
+}
+
+void BtResampler::Initialize(const DspResampleFilter* filter, AudioFrames period, u32 in_rate, u32 out_rate, void* mem)
+{
+    m_filter = filter;
+    m_history = (s16*) mem;
+    m_out = m_history + 2 * (filter->taps + period.count);
+    m_out_capacity = MaxOutput(period, in_rate, out_rate).count;
+    m_nominal_step = (((u64)in_rate << 32) + out_rate / 2) / out_rate;
+    m_step = m_nominal_step;
+    m_pos = 0;
+
+    // Start from silence, lined up so that the first output is the first
+    // input frame.
+    m_history_frames = filter->taps / 2 - 1;
+    memset(m_history, 0, m_history_frames * RESAMPLE_FRAME_BYTES);
+}
+
+void BtResampler::SetCorrection(s32 ppm)
+{
+    m_step = m_nominal_step + ((s64)m_nominal_step * ppm) / 1000000;
+}
+
+AudioFrames BtResampler::Process(const s16* src, AudioFrames frames, const s16** out)
+{
+    memcpy(m_history + 2 * m_history_frames, src, frames.count * RESAMPLE_FRAME_BYTES);
+    m_history_frames += frames.count;
+
+    size_t n = DspResample(m_out, m_out_capacity, m_history, m_history_frames, m_filter, &m_pos, m_step);
+
+    // Keep what the next output still needs.
+    size_t used = m_pos >> 32;
+    memmove(m_history, m_history + 2 * used, (m_history_frames - used) * RESAMPLE_FRAME_BYTES);
+    m_history_frames -= used;
+    m_pos -= (u64)used << 32;
+
+    *out = m_out;
+    return { n };
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "bt_audio_format.h"
+#include "bt_dsp.h"
+
+// Converts the capture stream to the rate a device's audio out was started
+// at, one period at a time, on the device's send thread; the capture itself
+// is shared, and always runs at the capture rate. The ratio can be corrected
+// by some ppm, to follow the headset's clock.
+//
+// Input that the filter still needs is carried over to the next period, so
+// period boundaries are seamless. The position moves on by a Q32.32 step,
+// and is never rounded to whole periods: output periods simply come out one
+// frame longer or shorter now and then.
+class BtResampler {
+public:
+    BtResampler();
+
+    // Memory Initialize() needs, for periods of up to `period` frames.
+    static size_t MemSize(const DspResampleFilter* filter, AudioFrames period, u32 in_rate, u32 out_rate);
+
+    // The filter and mem are the caller's, and must outlive the resampler's
+    // use.
+    void Initialize(const DspResampleFilter* filter, AudioFrames period, u32 in_rate, u32 out_rate, void* mem);
+
+    // Converts one period. *out holds the result until the next call.
+    AudioFrames Process(const s16* src, AudioFrames frames, const s16** out);
+
+    // Scales the input consumed per output frame by 1 + ppm / 1000000, from
+    // the next period on. |ppm| up to TUNING_MAX_DRIFT_PPM.
+    void SetCorrection(s32 ppm);
+
+    // Input frames between a frame going in and coming out.
+    AudioFrames GetDelay() const { return { m_filter->taps / 2 }; }
+
+private:
+    static AudioFrames MaxOutput(AudioFrames period, u32 in_rate, u32 out_rate);
+
+private:
+    const DspResampleFilter* m_filter;
+    s16*   m_history;           // unconsumed input, then the new period
+    size_t m_history_frames;
+    s16*   m_out;
+    size_t m_out_capacity;
+    u64    m_pos;               // next output in m_history, Q32.32
+    u64    m_step;              // input frames per output frame, Q32.32
+    u64    m_nominal_step;
+};
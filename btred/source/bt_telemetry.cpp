@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <sys/stat.h>
+#include <switch.h>
+#include "bt_driver_lock.h"
+#include "bt_telemetry.h"
+
+BtTelemetry g_telemetry;
+
+// Often enough to catch a glitch in the log after the fact, rarely enough
+// not to wear the SD card. Nothing is written while nothing changes.
+#define TELEMETRY_FLUSH_INTERVAL_NS (10000000000ULL)
+
+static void Summarize(BtTelemetrySummary* out, BtHistogram& h)
+{
+    out->count = h.GetCount();
+    out->p50 = h.GetPercentile(50);
+    out->p99 = h.GetPercentile(99);
+    out->max = h.GetMax();
+}
+
+static void Snapshot(BtTelemetryRecord* out, BtDeviceTelemetry* d, bool is_connected)
+{
+    memset(out, 0, sizeof(*out));
+    out->addr = d->addr;
+    out->is_connected = is_connected;
+    out->min_buffering_us = d->min_buffering_ns / 1000;
+    out->max_buffering_us = d->max_buffering_ns / 1000;
+    out->open_ms = d->open_ms;
+    out->ready_ms = d->ready_ms;
+    out->start_ms = d->start_ms;
+    out->first_audio_ms = d->first_audio_ms.load(std::memory_order_relaxed);
+    out->sample_rate = d->sample_rate;
+    out->drift_ppm = d->drift_ppm.load(std::memory_order_relaxed);
+
+    out->periods_sent = d->periods_sent.load(std::memory_order_relaxed);
+    out->send_failures = d->send_failures.load(std::memory_order_relaxed);
+    out->short_transfers = d->short_transfers.load(std::memory_order_relaxed);
+    out->resyncs = d->resyncs.load(std::memory_order_relaxed);
+    out->stale_drops = d->stale_drops.load(std::memory_order_relaxed);
+    out->refreshes = d->refreshes.load(std::memory_order_relaxed);
+    out->overruns = d->overruns.load(std::memory_order_relaxed);
+    out->underruns = d->underruns.load(std::memory_order_relaxed);
+
+    Summarize(&out->capture_to_gain, d->capture_to_gain);
+    Summarize(&out->capture_to_send, d->capture_to_send);
+    Summarize(&out->send_duration, d->send_duration);
+    Summarize(&out->send_jitter, d->send_jitter);
+
+    Summarize(&out->resample_duration, d->resample_duration);
+
+    out->safety_mutes = d->safety_mutes.load(std::memory_order_relaxed);
+    out->idle_ms = d->idle_ms.load(std::memory_order_relaxed);
+    out->idle_saved_us = d->idle_saved_us.load(std::memory_order_relaxed);
+}
+
+
+BtTelemetry::BtTelemetry():
+    m_devices{},
+    m_num_departed(0),
+    m_heap_break_peak(0),
+    m_heap_used_peak(0),
+    m_num_last_records(0),
+    m_last_system{},
+    m_is_initialized(false)
+{
+    mutexInit(&m_mutex);
+}
+
+BtTelemetry::~BtTelemetry()
+{
+    Finalize();
+}
+
+Result BtTelemetry::Initialize()
+{
+    #define TelemetryStackSize 0x2000
+    // Lowest priority there is; file I/O must never compete with audio.
+    #define TelemetryPrio 0x3F
+    #define TelemetryCore -2
+    Result rc;
+
+    m_workthread_stack = memalign(0x1000, TelemetryStackSize);
+
+    if (m_workthread_stack == NULL) {
+        return -1;
+    }
+
+    rc = threadCreate(
+        &m_workthread,
+        (ThreadFunc) WorkerThreadTrampoline,
+        (void*) this,
+        m_workthread_stack,
+        TelemetryStackSize,
+        TelemetryPrio,
+        TelemetryCore);
+
+    if (R_FAILED(rc)) {
+        free(m_workthread_stack);
+        return rc;
+    }
+
+    ueventCreate(&m_workthread_exitsignal, false);
+    utimerCreate(&m_flush_timer, TELEMETRY_FLUSH_INTERVAL_NS, TimerType_Repeating);
+
+    rc = threadStart(&m_workthread);
+
+    if (R_FAILED(rc)) {
+        threadClose(&m_workthread);
+        free(m_workthread_stack);
+        return rc;
+    }
+
+    m_is_initialized = true;
+    return rc;
+}
+
+void BtTelemetry::Finalize()
+{
+    if (m_is_initialized) {
+        ueventSignal(&m_workthread_exitsignal);
+        threadWaitForExit(&m_workthread);
+        threadClose(&m_workthread);
+        free(m_workthread_stack);
+        m_is_initialized = false;
+    }
+}
+
+void BtTelemetry::Register(BtDeviceTelemetry* device)
+{
+    mutexLock(&m_mutex);
+
+    for (auto& slot: m_devices) {
+        if (slot == NULL) {
+            slot = device;
+            break;
+        }
+    }
+
+    mutexUnlock(&m_mutex);
+}
+
+void BtTelemetry::Unregister(BtDeviceTelemetry* device)
+{
+    mutexLock(&m_mutex);
+
+    for (auto& slot: m_devices) {
+        if (slot == device) {
+            slot = NULL;
+
+            // Keep its final numbers in the log; only the most recent
+            // departures are kept.
+            if (m_num_departed == TELEMETRY_MAX_DEVICES) {
+                memmove(&m_departed[0], &m_departed[1], sizeof(m_departed[0]) * (TELEMETRY_MAX_DEVICES - 1));
+                m_num_departed--;
+            }
+
+            Snapshot(&m_departed[m_num_departed++], device, false);
+            break;
+        }
+    }
+
+    mutexUnlock(&m_mutex);
+}
+
+void BtTelemetry::SampleHeap()
+{
+    // newlib grows the heap with sbrk within the static heap of
+    // __libnx_initheap; arena is how far the break went.
+    struct mallinfo info = mallinfo();
+
+    mutexLock(&m_mutex);
+
+    if ((u32) info.arena > m_heap_break_peak)
+        m_heap_break_peak = info.arena;
+
+    if ((u32) info.uordblks > m_heap_used_peak)
+        m_heap_used_peak = info.uordblks;
+
+    mutexUnlock(&m_mutex);
+}
+
+void BtTelemetry::Flush()
+{
+    extern char* fake_heap_start;
+    extern char* fake_heap_end;
+
+    BtTelemetryRecord* records = m_records;
+    size_t num_records = 0;
+
+    SampleHeap();
+
+    // Only the copy happens under the lock; the SD card is written without it.
+    mutexLock(&m_mutex);
+
+    for (size_t i=0; i<m_num_departed; i++) {
+        records[num_records++] = m_departed[i];
+    }
+
+    for (auto device: m_devices) {
+        if (device != NULL)
+            Snapshot(&records[num_records++], device, true);
+    }
+
+    BtTelemetrySystemRecord system;
+    memset(&system, 0, sizeof(system));
+    system.heap_size = fake_heap_end - fake_heap_start;
+    system.heap_break_peak = m_heap_break_peak;
+    system.heap_used = mallinfo().uordblks;
+    system.heap_used_peak = m_heap_used_peak;
+
+    mutexUnlock(&m_mutex);
+
+    system.boot_probe_ms = m_system.boot_probe_ms.load(std::memory_order_relaxed);
+    system.boot_ms = m_system.boot_ms.load(std::memory_order_relaxed);
+    system.reconnect_attempts = m_system.reconnect_attempts.load(std::memory_order_relaxed);
+    system.reconnects = m_system.reconnects.load(std::memory_order_relaxed);
+    Summarize(&system.time_to_reconnect, m_system.time_to_reconnect);
+    Summarize(&system.control_lock_wait, g_btdrv_control_lock.GetWaits());
+    Summarize(&system.wake_to_audio, m_system.wake_to_audio);
+    Summarize(&system.connect_config, m_system.connect_config);
+    Summarize(&system.config_write, m_system.config_write);
+
+    bool is_dirty = num_records != m_num_last_records ||
+        memcmp(records, m_last_records, num_records * sizeof(records[0])) != 0 ||
+        memcmp(&system, &m_last_system, sizeof(system)) != 0;
+
+    if (!is_dirty)
+        return;
+
+    memcpy(m_last_records, records, num_records * sizeof(records[0]));
+    m_num_last_records = num_records;
+    m_last_system = system;
+
+    BtTelemetryHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TELEMETRY_MAGIC;
+    header.version = TELEMETRY_VERSION;
+    header.record_size = sizeof(BtTelemetryRecord);
+    header.uptime_us = armTicksToNs(svcGetSystemTick()) / 1000;
+    header.num_records = num_records;
+    header.system_size = sizeof(system);
+
+    mkdir("config", 0666);
+    mkdir("config/btred", 0666);
+
+    // Write then rename, so a reader never sees a half-written snapshot.
+    FILE* fd = fopen("config/btred/telemetry.tmp", "wb");
+
+    if (fd == NULL)
+        return;
+
+    bool ok = fwrite(&header, sizeof(header), 1, fd) == 1;
+    ok = ok && fwrite(&system, sizeof(system), 1, fd) == 1;
+
+    if (num_records > 0)
+        ok = ok && fwrite(records, sizeof(records[0]), num_records, fd) == num_records;
+
+    fclose(fd);
+
+    if (ok) {
+        remove("config/btred/telemetry.bin");
+        rename("config/btred/telemetry.tmp", "config/btred/telemetry.bin");
+    }
+}
+
+void BtTelemetry::WorkerThread()
+{
+    bool running = true;
+    Result rc = 0;
+
+    utimerStart(&m_flush_timer);
+
+    while (running)
+    {
+        int idx;
+
+        rc = waitMulti(
+            &idx, -1,
+            waiterForUEvent(&m_workthread_exitsignal),
+            waiterForUTimer(&m_flush_timer));
+
+        if (R_FAILED(rc))
+            fatalThrow(rc);
+
+        switch (idx)
+        {
+            case 0: // m_workthread_exitsignal
+                running = false;
+                break;
+
+            case 1: // m_flush_timer
+                Flush();
+                break;
+        }
+    }
+
+    utimerStop(&m_flush_timer);
+    Flush();
+}
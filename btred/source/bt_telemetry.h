@@ -0,0 +1,200 @@
+#pragma once
+
+#include <atomic>
+#include "bt_histogram.h"
+
+#define TELEMETRY_MAX_DEVICES 8
+
+// Live pipeline statistics of one device. Each field has a single writer
+// (the capture or the send thread), and is read by the telemetry thread.
+struct BtDeviceTelemetry {
+    BtdrvAddress addr;
+    u64 min_buffering_ns;
+    u64 max_buffering_ns;
+
+    // Bring-up phases, in milliseconds.
+    u32 open_ms;                    // open the audio out
+    u32 ready_ms;                   // wait until it's ready
+    u32 start_ms;                   // start it
+    std::atomic<u32> first_audio_ms;    // open -> first period sent
+
+    u32 sample_rate;                // the audio out was started at
+    std::atomic<s32> drift_ppm;     // headset clock vs audrec's, estimated
+
+    BtHistogram capture_to_gain;    // audrec release -> gain applied
+    BtHistogram capture_to_send;    // audrec release -> btdrvSendAudioData returned
+    BtHistogram send_duration;      // time spent in btdrvSendAudioData
+    BtHistogram send_jitter;        // |send interval - period|
+    BtHistogram resample_duration;  // converting one period to sample_rate
+
+    std::atomic<u64> periods_sent;
+    std::atomic<u64> send_failures;
+    std::atomic<u64> short_transfers;
+    std::atomic<u64> resyncs;
+    std::atomic<u64> stale_drops;
+    std::atomic<u64> refreshes;
+    std::atomic<u64> overruns;
+    std::atomic<u64> underruns;
+    std::atomic<u64> safety_mutes;  // the limiter muted unsafe output
+
+    // Silence that wasn't sent, and the send thread's time that saved: each
+    // period at the going cost of processing and sending one.
+    std::atomic<u64> idle_ms;
+    std::atomic<u64> idle_saved_us;
+
+    static void Bump(std::atomic<u64>& counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+};
+
+// Statistics of the sysmodule as a whole, rather than of one device. Written
+// from the main thread during boot, then the manager thread; except for
+// wake_to_audio, which the first device to send after a wake records, and
+// config_write, which the config writer records.
+struct BtSystemTelemetry {
+    std::atomic<u32> boot_probe_ms;     // until all services answered
+    std::atomic<u32> boot_ms;           // until the manager was up
+    std::atomic<u64> reconnect_attempts;
+    std::atomic<u64> reconnects;
+    BtHistogram time_to_reconnect;  // milliseconds, link loss -> device back
+
+    std::atomic<u64> wake_ns;       // last wake-up, until audio is back or given up on
+    BtHistogram wake_to_audio;      // milliseconds, wake-up -> first period sent
+
+    BtHistogram connect_config;     // a connect's time in g_config
+    BtHistogram config_write;       // refreshing and writing devices.bin
+};
+
+// On-SD snapshot format, config/btred/telemetry.bin: a header, the system
+// record, then num_records device records. Little-endian; times are in
+// microseconds unless noted otherwise.
+#define TELEMETRY_MAGIC 0x4D544254 // "BTTM"
+#define TELEMETRY_VERSION 2
+
+struct BtTelemetrySummary {
+    u32 count;
+    u32 p50;
+    u32 p99;
+    u32 max;
+};
+
+struct BtTelemetryHeader {
+    u32 magic;
+    u16 version;
+    u16 record_size;
+    u64 uptime_us;
+    u32 num_records;
+    u32 system_size;
+};
+
+struct BtTelemetrySystemRecord {
+    u32 boot_probe_ms;
+    u32 boot_ms;
+    u64 reconnect_attempts;
+    u64 reconnects;
+    BtTelemetrySummary time_to_reconnect; // ms
+    BtTelemetrySummary control_lock_wait;
+
+    // Bytes. The break only moves up, so its peak is how small the static
+    // heap could be; in-use is sampled, so its peak is a lower bound.
+    u32 heap_size;
+    u32 heap_break_peak;
+    u32 heap_used;
+    u32 heap_used_peak;
+
+    BtTelemetrySummary wake_to_audio; // ms
+    BtTelemetrySummary connect_config;
+    BtTelemetrySummary config_write;
+};
+
+struct BtTelemetryRecord {
+    BtdrvAddress addr;
+    u8  is_connected;
+    u8  reserved;
+    u32 min_buffering_us;
+    u32 max_buffering_us;
+    u32 open_ms;
+    u32 ready_ms;
+    u32 start_ms;
+    u32 first_audio_ms;
+    u32 sample_rate;    // Hz
+    s32 drift_ppm;      // positive: the headset is slow
+
+    u64 periods_sent;
+    u64 send_failures;
+    u64 short_transfers;
+    u64 resyncs;
+    u64 stale_drops;
+    u64 refreshes;
+    u64 overruns;
+    u64 underruns;
+
+    BtTelemetrySummary capture_to_gain;
+    BtTelemetrySummary capture_to_send;
+    BtTelemetrySummary send_duration;
+    BtTelemetrySummary send_jitter;
+    BtTelemetrySummary resample_duration;
+
+    u64 safety_mutes;
+    u64 idle_ms;
+    u64 idle_saved_us;
+};
+
+static_assert(sizeof(BtTelemetryHeader) == 0x18);
+static_assert(sizeof(BtTelemetrySystemRecord) == 0x78);
+static_assert(sizeof(BtTelemetryRecord) == 0xD0);
+
+// Collects the telemetry of all devices, and periodically flushes a compact
+// snapshot to the SD card from a low-priority thread. The audio threads
+// only ever touch their own BtDeviceTelemetry.
+class BtTelemetry {
+public:
+    BtTelemetry();
+    ~BtTelemetry();
+
+    Result Initialize();
+    void   Finalize();
+
+    void Register(BtDeviceTelemetry* device);
+    void Unregister(BtDeviceTelemetry* device);
+
+    BtSystemTelemetry& System() { return m_system; }
+
+    // Called wherever the heap is likely to have peaked.
+    void SampleHeap();
+
+private:
+    void Flush();
+
+    static void WorkerThreadTrampoline(BtTelemetry* self) {
+        self->WorkerThread();
+    }
+    void WorkerThread();
+
+private:
+    BtSystemTelemetry m_system;
+
+    Mutex  m_mutex;
+    BtDeviceTelemetry* m_devices[TELEMETRY_MAX_DEVICES];
+
+    // Final records of the most recently disconnected devices.
+    BtTelemetryRecord m_departed[TELEMETRY_MAX_DEVICES];
+    size_t m_num_departed;
+
+    u32    m_heap_break_peak;
+    u32    m_heap_used_peak;
+
+    // Worker thread only.
+    BtTelemetryRecord m_records[2*TELEMETRY_MAX_DEVICES];
+    BtTelemetryRecord m_last_records[2*TELEMETRY_MAX_DEVICES];
+    size_t m_num_last_records;
+    BtTelemetrySystemRecord m_last_system;
+
+    bool   m_is_initialized;
+    Thread m_workthread;
+    void*  m_workthread_stack;
+    UEvent m_workthread_exitsignal;
+    UTimer m_flush_timer;
+};
+
+extern BtTelemetry g_telemetry;
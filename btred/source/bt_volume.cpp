@@ -0,0 +1,143 @@
+#include <malloc.h>
+#include <math.h>
+#include <switch.h>
+#include "bt_dsp.h"
+#include "bt_volume.h"
+
+BtVolume g_volume;
+
+// The console volume only changes on user input, so this is plenty.
+#define VOLUME_POLL_INTERVAL_NS (50000000ULL)
+
+
+BtVolume::BtVolume():
+    m_level(0),
+    m_is_initialized(false)
+{
+    // Here's how I arrived at that number.
+    // x^0 = 1
+    // x^15 = 1/128
+    // x = 0.7236346187201891
+
+    size_t i;
+    for (i=0; i<NUM_VOLUME_LEVELS; i++) {
+        m_gain_table[i] = DspGainToQ15(powf(0.7236f, (NUM_VOLUME_LEVELS - 1) - i));
+    }
+
+    m_gain_table[0] = 0;
+}
+
+BtVolume::~BtVolume()
+{
+    Finalize();
+}
+
+Result BtVolume::Initialize()
+{
+    #define VolumeStackSize 0x2000
+    #define VolumePrio 0x30
+    #define VolumeCore -2
+    Result rc;
+
+    // Publish a valid level before any audio thread can ask for it.
+    rc = Poll();
+
+    if (R_FAILED(rc)) {
+        return rc;
+    }
+
+    m_workthread_stack = memalign(0x1000, VolumeStackSize);
+
+    if (m_workthread_stack == NULL) {
+        return -1;
+    }
+
+    rc = threadCreate(
+        &m_workthread,
+        (ThreadFunc) WorkerThreadTrampoline,
+        (void*) this,
+        m_workthread_stack,
+        VolumeStackSize,
+        VolumePrio,
+        VolumeCore);
+
+    if (R_FAILED(rc)) {
+        free(m_workthread_stack);
+        return rc;
+    }
+
+    ueventCreate(&m_workthread_exitsignal, false);
+    utimerCreate(&m_poll_timer, VOLUME_POLL_INTERVAL_NS, TimerType_Repeating);
+
+    rc = threadStart(&m_workthread);
+
+    if (R_FAILED(rc)) {
+        threadClose(&m_workthread);
+        free(m_workthread_stack);
+        return rc;
+    }
+
+    m_is_initialized = true;
+    return rc;
+}
+
+void BtVolume::Finalize()
+{
+    if (m_is_initialized) {
+        ueventSignal(&m_workthread_exitsignal);
+        threadWaitForExit(&m_workthread);
+        threadClose(&m_workthread);
+        free(m_workthread_stack);
+        m_is_initialized = false;
+    }
+}
+
+Result BtVolume::Poll()
+{
+    SetSysAudioVolume vol;
+    Result rc = setsysGetAudioVolume(SetSysAudioDevice_Console, &vol);
+
+    if (R_FAILED(rc))
+        return rc;
+
+    if (vol.volume >= NUM_VOLUME_LEVELS)
+        fatalThrow(0x1111);
+
+    m_level.store(vol.volume, std::memory_order_relaxed);
+    return rc;
+}
+
+void BtVolume::WorkerThread()
+{
+    bool running = true;
+    Result rc = 0;
+
+    utimerStart(&m_poll_timer);
+
+    while (running)
+    {
+        int idx;
+
+        rc = waitMulti(
+            &idx, -1,
+            waiterForUEvent(&m_workthread_exitsignal),
+            waiterForUTimer(&m_poll_timer));
+
+        if (R_FAILED(rc))
+            fatalThrow(rc);
+
+        switch (idx)
+        {
+            case 0: // m_workthread_exitsignal
+                running = false;
+                break;
+
+            case 1: // m_poll_timer
+                // A failed poll keeps the last known level.
+                Poll();
+                break;
+        }
+    }
+
+    utimerStop(&m_poll_timer);
+}
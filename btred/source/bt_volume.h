@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+
+#define NUM_VOLUME_LEVELS 16
+
+// Tracks the console volume off the audio path. A low-priority thread polls
+// set:sys on a slow timer, and publishes the current level atomically, so
+// that the audio threads only do a table lookup per buffer. Gains are Q15,
+// see bt_dsp.h.
+class BtVolume {
+public:
+    BtVolume();
+    ~BtVolume();
+
+    Result Initialize();
+    void   Finalize();
+
+    u32   GetLevel()   { return m_level.load(std::memory_order_relaxed); }
+    s16   GetGainQ15() { return m_gain_table[GetLevel()]; }
+
+private:
+    Result Poll();
+
+    static void WorkerThreadTrampoline(BtVolume* self) {
+        self->WorkerThread();
+    }
+    void WorkerThread();
+
+private:
+    s16    m_gain_table[NUM_VOLUME_LEVELS];
+    std::atomic<u32> m_level;
+
+    bool   m_is_initialized;
+    Thread m_workthread;
+    void*  m_workthread_stack;
+    UEvent m_workthread_exitsignal;
+    UTimer m_poll_timer;
+};
+
+extern BtVolume g_volume;
@@ -3,37 +3,125 @@
 #include <switch.h>
 #include "bt_audio_manager.h"
 #include "bt_config.h"
+#include "bt_device_pool.h"
+#include "bt_driver_lock.h"
+#include "bt_telemetry.h"
+#include "bt_volume.h"
 
-Mutex g_btdrv_mutex;
+BtDriverLock g_btdrv_control_lock;
 
 void NORETURN fatalThrowWithPc(Result err);
 
+static u64 NowNs()
+{
+    return armTicksToNs(svcGetSystemTick());
+}
+
+static Result ProbeBtdrv()
+{
+    BtdrvAddress addrs[8];
+    s32 total_out;
+    Result rc = btdrvInitialize();
+
+    if (R_FAILED(rc))
+        return rc;
+
+    // Registered isn't the same as ready; make sure it answers.
+    rc = btdrvGetConnectedAudioDevice(addrs, 8, &total_out);
+
+    if (R_FAILED(rc))
+        btdrvExit();
+
+    return rc;
+}
+
+// We are launched while the services we depend on are still coming up.
+// Rather than sleep a fixed time, retry until they all answer. Each service
+// keeps the reference taken here for the life of the sysmodule, so later
+// Initialize calls can't fail on it.
+static Result ProbeServices()
+{
+    #define PROBE_INTERVAL_NS 20000000ULL
+    #define PROBE_TIMEOUT_NS  30000000000ULL
+
+    static Result (*const probes[])(void) = {
+        setsysInitialize,
+        audctlInitialize,
+        audrecInitialize,
+        pscmInitialize,
+        ProbeBtdrv,
+    };
+
+    u64 deadline = NowNs() + PROBE_TIMEOUT_NS;
+    Result rc = 0;
+
+    for (auto probe: probes) {
+        while (R_FAILED(rc = probe())) {
+            if (NowNs() > deadline)
+                return rc;
+
+            svcSleepThread(PROBE_INTERVAL_NS);
+        }
+    }
+
+    return rc;
+}
+
 
 int main(int argc, char *argv[])
 {
+    BtSystemTelemetry& stats = g_telemetry.System();
+    u64 start = NowNs();
     Result rc;
 
-    mutexInit(&g_btdrv_mutex);
+    rc = ProbeServices();
 
-    // Temporary workaround for race condition during boot.
-    // TODO: Investigate deeper
-    svcSleepThread(5000000000ULL);
+    if (R_FAILED(rc))
+        fatalThrowWithPc(rc);
 
-    rc = g_audio_manager.Initialize();
+    stats.boot_probe_ms = (NowNs() - start) / 1000000;
+
+    // Devices pick up their tuning when they are created.
+    rc = g_config.LoadTuning();
 
     if (R_FAILED(rc))
         fatalThrowWithPc(rc);
 
-    rc = g_config.Initialize();
+    rc = g_config.LoadDevices();
 
     if (R_FAILED(rc))
         fatalThrowWithPc(rc);
 
-    rc = setsysInitialize();
+    rc = g_device_pool.Initialize();
 
     if (R_FAILED(rc))
         fatalThrowWithPc(rc);
 
+    // Must be up before any device starts streaming.
+    rc = g_volume.Initialize();
+
+    if (R_FAILED(rc))
+        fatalThrowWithPc(rc);
+
+    rc = g_telemetry.Initialize();
+
+    if (R_FAILED(rc))
+        fatalThrowWithPc(rc);
+
+    rc = g_audio_manager.Initialize();
+
+    if (R_FAILED(rc))
+        fatalThrowWithPc(rc);
+
+    // Restores the pairings of the headsets in devices.bin, and starts
+    // writing changes back.
+    rc = g_config.Initialize();
+
+    if (R_FAILED(rc))
+        fatalThrowWithPc(rc);
+
+    stats.boot_ms = (NowNs() - start) / 1000000;
+
     while (1)
         g_audio_manager.PollEvents();
 